@@ -0,0 +1,67 @@
+/* cache.h - Incremental re-analysis for deborphan.
+
+   Distributed under the terms of the MIT License, see the
+   file COPYING provided in this package for details.
+*/
+#pragma once
+
+#include <hash.h>
+
+#include "deborphan.h"
+
+/* One stanza of the status file, as seen by the last analysis. */
+typedef struct stanza_rec {
+    unsigned long long hash; /* memhash() of the stanza's text */
+    size_t len;
+    pkg_info pkg;
+    int inlist; /* takes part in the analysis, see read_status() */
+    int orphan; /* is reported */
+    int seen;   /* matched a stanza of the current status file */
+    int fresh;  /* parsed during this run */
+    struct stanza_rec* next;
+    struct stanza_rec* next_seen; /* order in the status file being read */
+} stanza_rec;
+
+/* A parsed status file together with its reverse dependency counts.
+ * Records are kept in status file order, so printing the orphans gives
+ * exactly the output of a full run.
+ */
+typedef struct snapshot {
+    context* ctx; /* what the records were analysed with */
+    stanza_rec* recs;
+    hashtable byhash; /* stanza hash -> stanza_rec */
+    hashtable rdeps;  /* dependency name -> name_ref */
+    unsigned long long parse_fp;
+    unsigned long long check_fp;
+    int multiarch;
+    int reparsed; /* stanzas parsed by the last update */
+    int rechecked; /* packages rechecked by the last update */
+} snapshot;
+
+/* The orphans of a snapshot at one point in time. */
+typedef struct orphan_set {
+    char** keys; /* "name:arch", in status file order */
+    size_t* namelen;
+    long* sizes;
+    size_t cnt;
+    hashtable idx;
+} orphan_set;
+
+void snapshot_init(snapshot* s, context* ctx);
+void snapshot_free(snapshot* s);
+int snapshot_load(snapshot* s, const char* cfile);
+int snapshot_save(const snapshot* s, const char* cfile);
+int snapshot_update(snapshot* s, char* content);
+void snapshot_recheck(snapshot* s);
+int rec_verdict(const snapshot* s, stanza_rec* rec);
+void snapshot_print(const snapshot* s);
+int snapshot_verify(const snapshot* s, char* content);
+void collect_orphans(const snapshot* s, orphan_set* set);
+void free_orphans(orphan_set* set);
+int orphan_set_has(const orphan_set* set, const char* key);
+void print_missing(const context* ctx,
+                   const orphan_set* a,
+                   const orphan_set* b,
+                   int sign,
+                   int print_suffix);
+int run_incremental(context* ctx, char* content, const char* cfile);
@@ -9,6 +9,9 @@
 #pragma once
 
 #include <config.h>
+#include <hash.h>
+#include <pattern.h>
+#include <regex.h>
 #include <stdio.h>
 
 /* Faster than toupper. Less reliable too. */
@@ -20,6 +23,36 @@ typedef struct dep {
     unsigned int namehash;
 } dep;
 
+/* The packages to keep, in the order they were read, and an index on
+ * their names. Entries with wildcards are also compiled into patterns.
+ */
+typedef struct keep_list {
+    dep* names; /* terminated by an entry without a name */
+    size_t cnt;
+    size_t max;
+    hashtable idx;
+    pattern_set patterns;
+} keep_list;
+
+/* The packages asked for on the command line. Entries with the same
+ * name are chained, the index holds the first of them.
+ */
+typedef struct search_list {
+    dep* pkgs; /* terminated by an entry without a name */
+    size_t cnt;
+    size_t given; /* the rest was added by search_expand() */
+    int* found;
+    int* next_same; /* or -1 */
+    hashtable idx;
+} search_list;
+
+/* Output collected by a thread, see out_capture(). */
+typedef struct out_chunk {
+    char* buf;
+    size_t len;
+    size_t max;
+} out_chunk;
+
 /* Options for option[IGNORE_LIBS]
  */
 #define IGNORE_LIB_DEV  (1 << 0)
@@ -33,6 +66,12 @@ typedef struct dep {
 #define INIT_PROVIDES_COUNT 4
 #define INIT_EXCLUDES_COUNT 4
 
+/* How long the status file has to stay untouched after a change before
+ * --watch and --serve read it again; dpkg writes it several times during
+ * a single run.
+ */
+#define WATCH_SETTLE_MS 500
+
 /* These arrays aren't exactly neat, but it seems they suffice. */
 typedef struct pkg_info {
     dep self;
@@ -50,6 +89,8 @@ typedef struct pkg_info {
     int dummy;
     int config;
     long installed_size;
+    int auto_installed; /* only set with --auto-only */
+    int excluded;       /* only kept with --explain-filter */
     struct pkg_info* next;
 } pkg_info;
 
@@ -78,12 +119,42 @@ enum {
     FIND_CONFIG,
     SEARCH_LIBDEVEL,
     CHECK_OPTIONS,
+    VERIFY_CACHE,
+    WATCH,
+    AUTO_ONLY,
+    FORMAT,
+    JOBS,
+    ROOTS,
+    FLEET,
+    DIFF,
+    LOW_MEMORY,
+    LOW_IMPACT,
+    PURGE_LIST,
+    EXPLAIN_FILTER,
     NUM_OPTIONS /* THIS HAS TO BE THE LAST OF THIS ENUM! */
 };
 
+/* Why a package is not checked for dependents, see filter_reasons(). */
+enum {
+    FILTER_EXCLUDED = 1 << 0,
+    FILTER_NOT_CONFIG = 1 << 1,
+    FILTER_HELD = 1 << 2,
+    FILTER_NOT_AUTO = 1 << 3,
+    FILTER_PRIORITY = 1 << 4,
+    FILTER_KEPT = 1 << 5,
+    FILTER_ESSENTIAL = 1 << 6,
+    FILTER_NOT_LIBRARY = 1 << 7
+};
+
 /* options[SHOW_ARCH] is set to one of these values. */
 enum { DEFAULT = 0, ALWAYS, NEVER };
 
+/* options[FORMAT] is set to one of these values. */
+enum { FORMAT_TEXT = 0, FORMAT_JSONL, FORMAT_TSV, FORMAT_NUL };
+
+/* context.bad_status is set to one of these values while parsing. */
+enum { STATUS_OK = 0, STATUS_IMPROPER, STATUS_INVALID };
+
 #define GUESS_DEV (1 << 1)
 #define GUESS_PERL (1 << 2)
 #define GUESS_SECTION (1 << 3)
@@ -105,35 +176,101 @@ enum { DEFAULT = 0, ALWAYS, NEVER };
      GUESS_JAVA)
 #define GUESS_ALL 0xFFFFFFFF
 
-#define guess_chk(n) ((options[GUESS] & (n)) == (n))
-#define guess_set(n) (options[GUESS] |= (n))
-#define guess_clr(n) (options[GUESS] &= ~(n))
-#define guess_unique(n) (!(options[GUESS] ^ (n)))
+#define guess_chk(ctx, n) (((ctx)->options[GUESS] & (n)) == (n))
+#define guess_set(ctx, n) ((ctx)->options[GUESS] |= (n))
+#define guess_clr(ctx, n) ((ctx)->options[GUESS] &= ~(n))
+#define guess_unique(ctx, n) (!((ctx)->options[GUESS] ^ (n)))
 #define pkgcmp(a, b) \
     (((a).namehash == (b).namehash ? (strcmp((a).name, (b).name) ? 0 : 1) : 0))
 
-extern dep* keep;
-extern int options[NUM_OPTIONS];
+/* The regular expressions used while parsing and checking packages,
+ * compiled by init_pkg_regex() according to the options.
+ */
+typedef struct pkg_regex {
+    regex_t statusinst;
+    regex_t statusnotinst;
+    regex_t statushold;
+    regex_t statusconfig;
+    regex_t status;
+    regex_t namedev;
+    regex_t gnugrepv;
+    regex_t descdummy;
+    regex_t desctransit;
+} pkg_regex;
+
+/* Everything an analysis depends on besides the status file. Nothing
+ * else is kept between the calls parsing and checking packages, so
+ * several analyses can be run at the same time, each with a context of
+ * its own. A context must only be used by one thread at a time, with
+ * the exception of the threads started for -j.
+ */
+typedef struct context {
+    int options[NUM_OPTIONS];
+    keep_list keep;
+    search_list search_for; /* packages given on the command line */
+    dep* exclude_list;      /* sorted by name */
+    size_t exclude_list_cnt;
+    size_t exclude_list_max;
+    hashtable auto_set; /* see apt.c */
+    char* states_file;
+    char* firstarch; /* the first architecture but "all" found */
+    pkg_regex re;
+    const char* root; /* with --root, the root being analysed */
+    int bad_status;   /* why the status file parsed last can't be used */
+} context;
+
 extern char* program_name;
 
+/* context.c */
+void context_init(context* ctx);
+void context_free(context* ctx);
+int add_exclude(context* ctx, char* name);
+int is_excluded(const context* ctx, const dep* d);
+
 /* pkginfo.c */
-void init_pkg_regex(void);
-void free_pkg_regex(void);
-void get_pkg_info(const char* line, pkg_info* package, int* multiarch);
+void init_pkg_regex(context* ctx);
+void free_pkg_regex(context* ctx);
+char* next_stanza(char** buf, size_t* len);
+void get_pkg_stanza(context* ctx,
+                    char* stanza,
+                    pkg_info* package,
+                    int* multiarch);
+pkg_info* read_status(context* ctx, char* content, int* multiarch);
+pkg_info* read_status_file(context* ctx, const char* sfile, int* multiarch);
+void free_pkg_list(pkg_info* package);
+void get_pkg_info(context* ctx,
+                  const char* line,
+                  pkg_info* package,
+                  int* multiarch);
 void get_pkg_priority(const char* line, pkg_info* package);
 void get_pkg_provides(const char* line, pkg_info* package);
 void get_pkg_name(const char* line, pkg_info* package);
-void get_pkg_status(const char* line, pkg_info* package);
+void get_pkg_status(context* ctx, const char* line, pkg_info* package);
 void get_pkg_section(const char* line, pkg_info* package);
 void get_pkg_deps(const char* line, pkg_info* package);
 void get_pkg_essential(const char* line, pkg_info* package);
 void get_pkg_installed_size(const char* line, pkg_info* package);
-void get_pkg_dummy(const char* line, pkg_info* package);
+void get_pkg_dummy(context* ctx, const char* line, pkg_info* package);
 int is_pkg_dev(pkg_info* package);
-unsigned int is_library(pkg_info* package, int search_libdevel);
+unsigned int is_library(context* ctx, pkg_info* package, int search_libdevel);
 
 /* libdeps.c */
-void check_lib_deps(pkg_info* package, pkg_info* current_pkg, int print_suffix);
+const char* filter_name(unsigned int reasons);
+unsigned int filter_reasons(context* ctx, pkg_info* current_pkg);
+const char* candidate_reason(context* ctx, pkg_info* current_pkg);
+int is_candidate(context* ctx, pkg_info* current_pkg);
+int has_dependents(pkg_info* package, pkg_info* current_pkg);
+int needs_dependents_check(const pkg_info* current_pkg);
+int is_reported(const context* ctx, pkg_info* current_pkg);
+void check_lib_deps(context* ctx,
+                    pkg_info* package,
+                    pkg_info* current_pkg,
+                    int print_suffix);
+void check_orphans(context* ctx, pkg_info* package, int print_suffix);
+void search_init(search_list* s, dep* pkgs);
+void search_expand(search_list* s, pkg_info* package);
+int search_take(search_list* s, const dep* self);
+void explain_filter(context* ctx, pkg_info* package, int print_suffix);
 
 /* exit.c */
 __attribute__((noreturn)) void error(int exit_status,
@@ -141,8 +278,10 @@ __attribute__((noreturn)) void error(int exit_status,
                                      const char* format,
                                      ...);
 void exit_help(void);
-void exit_improperstate(void);
-void exit_invalid_statusfile(void);
+__attribute__((noreturn)) void exit_improperstate(void);
+__attribute__((noreturn)) void exit_invalid_statusfile(void);
+__attribute__((noreturn)) void exit_bad_status(int bad_status);
+const char* bad_status_message(int bad_status);
 void exit_version(void);
 void print_usage(FILE* output);
 
@@ -151,22 +290,113 @@ int string_to_priority(const char* priority);
 const char* priority_to_string(int priority);
 void strstripchr(char* s, int c);
 unsigned int strhash(const char* line);
+unsigned long long memhash(const void* buf, size_t len);
 
 /* keep.c */
-dep* readkeep(const char* kfile);
-int mustkeep(dep d);
+void keep_init(keep_list* k);
+void keep_free(keep_list* k);
+int keep_add(keep_list* k, const char* name, size_t len);
+int readkeep(keep_list* k, const char* kfile);
+void readkeep_all(keep_list* k, const char* kfile, int no_debfoster);
+int mustkeep(keep_list* k, dep d);
 int delkeep(const char* kfile, char** del);
 int addkeep(const char* kfile, char** add);
-dep* mergekeep(const dep* a, const dep* b);
 void listkeepall(const char* kfile);
 int listkeep(const char* kfile);
 char** parseargs(int argind, int argc, char** argv);
 dep* parseargs_as_dep(int argind, int argc, char** argv);
-int hasduplicate(char** list);
-int pkggrep(const char* sfile, char** pkgnames);
+int hasduplicate(keep_list* k, char** list);
+int pkggrep(const char* sfile, char** pkgnames, int* found);
+
+/* watch.c */
+int watch_status(const char* sfile, char** name);
+int watch_events(int fd, const char* name);
+__attribute__((noreturn)) void run_watch(context* ctx,
+                                         const char* sfile,
+                                         const char* cfile);
+
+/* apt.c */
+int read_extended_states(context* ctx, const char* file);
+void free_extended_states(context* ctx);
+int is_auto_installed(const context* ctx, const dep* self);
+
+/* roots.c */
+int run_roots(context* ctx, char** roots, int cnt);
+
+/* fleet.c */
+int run_fleet(context* ctx, const char* dir, const char* kfile);
+
+/* diff.c */
+void run_diff(context* ctx, const char* oldfile, const char* newfile);
+
+/* lowmem.c */
+int run_lowmem(context* ctx, const char* sfile);
+
+/* configfiles.c */
+int run_find_config(context* ctx, const char* sfile);
+
+/* impact.c */
+void lower_impact(context* ctx);
+void forget_file(const context* ctx, const char* filename);
+long parse_size(const char* s);
+int exceeds_ceiling(const char* sfile, long ceiling);
+
+/* serve.c */
+__attribute__((noreturn)) void run_serve(context* ctx,
+                                         const char* sockpath,
+                                         const char* sfile,
+                                         const char* kfile,
+                                         const char* cfile);
+
+/* output.c */
+void out_flush(void);
+void out_capture(out_chunk* chunk);
+void out_release(out_chunk* chunk);
+void print_header(const context* ctx);
+void print_orphan(const context* ctx, pkg_info* current_pkg, int print_suffix);
+void print_deps_begin(const context* ctx,
+                      pkg_info* current_pkg,
+                      int print_suffix);
+void print_dependent(const context* ctx,
+                     pkg_info* dependent,
+                     int print_suffix);
+void print_deps_end(const context* ctx);
+void print_fleet_row(const context* ctx,
+                     const char* name,
+                     int hosts,
+                     long size);
+void print_change(const context* ctx,
+                  int sign,
+                  const char* name,
+                  const char* arch,
+                  long size,
+                  int print_suffix);
+void print_explained(const context* ctx,
+                     pkg_info* current_pkg,
+                     unsigned int reasons,
+                     int print_suffix);
+void print_purge_list(pkg_info** pkgs, size_t cnt, int print_suffix);
+void print_done(const context* ctx);
 
 /* file.c */
 char* debopen(const char* filename);
+char* debopen_status(const char* sfile);
+char* debmap(const char* filename, size_t* len);
+void debunmap(char* buf, size_t len);
+int status_has_updates(const char* sfile);
+
+/* reader.c */
+typedef struct stanza_reader stanza_reader;
+
+int is_compressed(const char* buf, size_t len);
+char* debread(int fd, const char* filename);
+
+stanza_reader* reader_open(const char* filename, int threaded);
+char* reader_next(stanza_reader* r, size_t* len);
+int reader_error(const stanza_reader* r);
+void reader_close(stanza_reader* r);
+char* status_updates_dir(const char* sfile);
+int is_journal_name(const char* name);
 int zerofile(const char* filename);
 
 #ifdef ENABLE_NLS
@@ -0,0 +1,46 @@
+/* hash.h - A small hash table for deborphan.
+
+   Distributed under the terms of the MIT License, see the
+   file COPYING provided in this package for details.
+*/
+#pragma once
+
+#include <stddef.h>
+
+/* An open addressing hash table. The table does not know what it
+ * stores: every entry is a 64 bit hash and a non-NULL pointer, and
+ * lookups take a callback that decides whether a stored value matches
+ * the key being searched for. Entries can not be removed; rebuild the
+ * table instead.
+ */
+typedef struct hash_slot {
+    unsigned long long hash;
+    void* value;
+} hash_slot;
+
+typedef struct hashtable {
+    hash_slot* slots;
+    size_t mask;
+    size_t used;
+} hashtable;
+
+typedef int (*hash_eq)(const void* value, const void* key);
+
+int hash_init(hashtable* t, size_t hint);
+void hash_free(hashtable* t);
+int hash_add(hashtable* t, unsigned long long hash, void* value);
+void* hash_find(const hashtable* t,
+                unsigned long long hash,
+                hash_eq eq,
+                const void* key);
+
+/* A reference counted name, used for the reverse dependency counts. */
+typedef struct name_ref {
+    char* name;
+    int count;
+    int dirty;
+} name_ref;
+
+name_ref* name_ref_get(hashtable* t, const char* name);
+name_ref* name_ref_find(const hashtable* t, const char* name);
+void name_ref_free_all(hashtable* t);
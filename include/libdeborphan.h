@@ -0,0 +1,119 @@
+/* libdeborphan.h - Finding orphaned packages from other programs.
+
+   Distributed under the terms of the MIT License, see the
+   file COPYING provided in this package for details.
+*/
+#pragma once
+
+/* libdeborphan runs the analysis of deborphan(1) inside the calling
+ * program. A handle holds a profile, i.e. the options, keep list and
+ * excludes, and the status file loaded last:
+ *
+ *   deborphan* d = deborphan_new();
+ *   deborphan_set(d, DEBORPHAN_PRIORITY, 4);
+ *   deborphan_load_file(d, "/var/lib/dpkg/status");
+ *   deborphan_orphans(d, print_it, NULL);
+ *   deborphan_free(d);
+ *
+ * Loading a status file again only parses the stanzas that changed, and
+ * the profile can be changed at any time; the next query sees the
+ * change. Functions returning int return -1 and set errno on failure.
+ *
+ * A handle must only be used by one thread at a time; different handles
+ * can be used at the same time. Only the functions and types declared
+ * here are part of the interface, which only ever grows: new options are
+ * added at the end of deborphan_option, new fields at the end of
+ * deborphan_pkg.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DEBORPHAN_API_VERSION 1
+
+typedef struct deborphan deborphan;
+
+/* A package as passed to the callbacks. The strings belong to the
+ * handle and are valid until the next call changing it.
+ */
+typedef struct deborphan_pkg {
+    const char* name;
+    const char* arch;     /* NULL if the status file has none */
+    const char* section;  /* NULL if the status file has none */
+    const char* priority; /* "required", ..., "extra" */
+    long installed_size;
+} deborphan_pkg;
+
+/* The options deborphan_set() takes. Each is set to 0 or 1 like the
+ * option of deborphan(1) named in the comment, except where noted.
+ */
+typedef enum deborphan_option {
+    DEBORPHAN_ALL_PACKAGES = 1,  /* --all-packages */
+    DEBORPHAN_PRIORITY,          /* --priority, as a number from 1 to 5 */
+    DEBORPHAN_IGNORE_RECOMMENDS, /* --ignore-recommends */
+    DEBORPHAN_IGNORE_SUGGESTS,   /* --ignore-suggests */
+    DEBORPHAN_FORCE_HOLD,        /* --force-hold */
+    DEBORPHAN_EXCLUDE_DEV,       /* --exclude-dev */
+    DEBORPHAN_LIBDEVEL,          /* --libdevel */
+    DEBORPHAN_GUESS_ONLY,        /* --guess-only */
+    DEBORPHAN_FIND_CONFIG,       /* --find-config */
+    DEBORPHAN_AUTO_ONLY          /* --auto-only, see deborphan_read_auto() */
+} deborphan_option;
+
+/* Called for every package a query finds. Returning anything but 0 ends
+ * the query.
+ */
+typedef int (*deborphan_cb)(const deborphan_pkg* pkg, void* data);
+
+/* Returns a handle with the default profile of deborphan(1), or NULL if
+ * there is not enough memory.
+ */
+deborphan* deborphan_new(void);
+void deborphan_free(deborphan* d);
+
+/* The profile. */
+int deborphan_set(deborphan* d, deborphan_option option, int value);
+/* Switch one of the --guess-* options on or off. name is one of those
+ * listed by --print-guess-list, "java" or "all".
+ */
+int deborphan_guess(deborphan* d, const char* name, int on);
+/* Never report the package name, which may be a pattern. */
+int deborphan_keep(deborphan* d, const char* name);
+/* Add the entries of a keep file, as written by deborphan --add-keep. */
+int deborphan_read_keep(deborphan* d, const char* path);
+/* Treat name as if it was not installed, like --exclude. */
+int deborphan_exclude(deborphan* d, const char* name);
+/* Read which packages APT installed automatically from its
+ * extended_states file, for DEBORPHAN_AUTO_ONLY. The file is read again
+ * on every load.
+ */
+int deborphan_read_auto(deborphan* d, const char* path);
+
+/* Load a status file, or a buffer with its contents. The file's pending
+ * updates by dpkg are applied as deborphan(1) does. A status file that
+ * can't be used, because it is invalid or packages are in an improper
+ * state, is refused with EBADMSG, and the one loaded before is kept.
+ */
+int deborphan_load_file(deborphan* d, const char* path);
+int deborphan_load_buffer(deborphan* d, const char* buf, size_t len);
+
+/* Call cb for every orphaned package, in the order of the status file.
+ * Returns the number of packages cb was called for.
+ */
+int deborphan_orphans(deborphan* d, deborphan_cb cb, void* data);
+/* Call cb for every installed package depending on name, or name:arch,
+ * or on something it provides, in the order of the status file. Returns
+ * the number of packages cb was called for; errno is ENOENT if there is
+ * no such package.
+ */
+int deborphan_dependents(deborphan* d,
+                         const char* name,
+                         deborphan_cb cb,
+                         void* data);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,53 @@
+/* pattern.h - Matching package names against many globs at once.
+
+   Distributed under the terms of the MIT License, see the
+   file COPYING provided in this package for details.
+*/
+#pragma once
+
+#include <hash.h>
+
+/* All patterns are stored in one trie. A `*' becomes a node that loops
+ * on every character, a `?' an edge taken by any character. Matching
+ * walks a DFA whose states are sets of trie nodes; they are built the
+ * first time a name needs them and kept, so a name is matched in one
+ * pass however many patterns there are.
+ */
+typedef struct pattern_edge {
+    unsigned char c;
+    int node;
+} pattern_edge;
+
+typedef struct pattern_node {
+    pattern_edge* edges;
+    int edges_cnt;
+    int any;  /* node after `?', or -1 */
+    int star; /* node after `*', or -1 */
+    int loop; /* this node was reached by `*' */
+    int accept;
+} pattern_node;
+
+typedef struct pattern_state {
+    int id;
+    int* nodes; /* sorted */
+    int nodes_cnt;
+    int accept;
+    int next[256];
+} pattern_state;
+
+typedef struct pattern_set {
+    pattern_node* nodes;
+    int nodes_cnt;
+    int nodes_max;
+    int patterns;
+    pattern_state** states;
+    int states_cnt;
+    int states_max;
+    hashtable state_idx; /* node set -> pattern_state */
+} pattern_set;
+
+int is_pattern(const char* s);
+int pattern_init(pattern_set* p);
+void pattern_free(pattern_set* p);
+int pattern_add(pattern_set* p, const char* pattern);
+int pattern_match(pattern_set* p, const char* name);
@@ -0,0 +1,121 @@
+/* apt.c - Read APT's extended_states for deborphan.
+
+   Distributed under the terms of the MIT License, see the
+   file COPYING provided in this package for details.
+*/
+
+/* APT remembers in its extended_states file which packages were only
+ * installed to satisfy a dependency ("Auto-Installed: 1"). With
+ * --auto-only, packages without that mark are never reported, so the
+ * output is what APT itself would consider removable.
+ */
+
+#include <hash.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "config.h"
+#include "deborphan.h"
+
+/* The keys of ctx->auto_set are "name:arch" and, for architecture
+ * independent lookups, "name" on its own. */
+
+static int key_eq(const void* value, const void* key) {
+    return strcmp((const char*)value, (const char*)key) == 0;
+}
+
+static void add_key(hashtable* auto_set, const char* name, const char* arch) {
+    char* key = malloc(strlen(name) + (arch ? strlen(arch) + 2 : 1));
+
+    strcpy(key, name);
+    if (arch) {
+        strcat(key, ":");
+        strcat(key, arch);
+    }
+    if (hash_find(auto_set, memhash(key, strlen(key)), key_eq, key))
+        free(key);
+    else
+        hash_add(auto_set, memhash(key, strlen(key)), key);
+}
+
+static void free_keys(hashtable* auto_set) {
+    size_t i;
+
+    for (i = 0; auto_set->slots && i <= auto_set->mask; i++)
+        free(auto_set->slots[i].value);
+    hash_free(auto_set);
+}
+
+/* Read the packages APT marked as automatically installed from file,
+ * or from the file read last time if file is NULL. On failure, -1 is
+ * returned and whatever was read before is kept.
+ */
+int read_extended_states(context* ctx, const char* file) {
+    char *content, *p, *stanza, *line;
+    size_t len;
+
+    if (file && file != ctx->states_file) {
+        free(ctx->states_file);
+        ctx->states_file = strdup(file);
+    }
+    if (!(content = debopen(ctx->states_file)))
+        return -1;
+
+    free_keys(&ctx->auto_set);
+    hash_init(&ctx->auto_set, 0);
+
+    p = content;
+    while ((stanza = next_stanza(&p, &len)) != NULL) {
+        char *name = NULL, *arch = NULL;
+        int is_auto = 0;
+
+        while ((line = strsep(&stanza, "\n")) != NULL) {
+            strstripchr(line, ' ');
+            if (strncasecmp(line, "Package:", 8) == 0)
+                name = line + 8;
+            else if (strncasecmp(line, "Architecture:", 13) == 0)
+                arch = line + 13;
+            else if (strncasecmp(line, "Auto-Installed:", 15) == 0)
+                is_auto = atoi(line + 15) == 1;
+        }
+
+        if (!name || !is_auto)
+            continue;
+        add_key(&ctx->auto_set, name, NULL);
+        if (arch)
+            add_key(&ctx->auto_set, name, arch);
+    }
+
+    free(content);
+    return 0;
+}
+
+void free_extended_states(context* ctx) {
+    free_keys(&ctx->auto_set);
+    free(ctx->states_file);
+    ctx->states_file = NULL;
+}
+
+/* APT records "Architecture: all" packages under the native
+ * architecture, so those only go by their name.
+ */
+int is_auto_installed(const context* ctx, const dep* self) {
+    const hashtable* auto_set = &ctx->auto_set;
+    char* key;
+    int found;
+
+    if (!self->name || !auto_set->slots)
+        return 0;
+    if (!self->arch || strcmp(self->arch, "all") == 0)
+        return hash_find(auto_set, memhash(self->name, strlen(self->name)),
+                         key_eq, self->name) != NULL;
+
+    key = malloc(strlen(self->name) + strlen(self->arch) + 2);
+    sprintf(key, "%s:%s", self->name, self->arch);
+    found = hash_find(auto_set, memhash(key, strlen(key)), key_eq, key) !=
+            NULL;
+    free(key);
+
+    return found;
+}
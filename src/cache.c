@@ -0,0 +1,721 @@
+/* cache.c - Incremental re-analysis for deborphan.
+
+   Distributed under the terms of the MIT License, see the
+   file COPYING provided in this package for details.
+*/
+
+/* The packages parsed by the last run are stored in a cache file, each
+ * together with the hash of the stanza it came from, and the verdict it
+ * got. The next run hashes every stanza of the status file, parses only
+ * those it does not know yet, updates the reverse dependency counts for
+ * the stanzas that appeared and disappeared and rechecks only packages
+ * that are new or whose counts changed.
+ *
+ * Instead of scanning the whole package list for every candidate, the
+ * verdict is taken from the number of dependencies on a package's name
+ * and on the names it provides. This gives the same answer as
+ * check_lib_deps(), which is what --verify-cache checks.
+ */
+
+#include <errno.h>
+#include <set.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cache.h>
+
+#include "config.h"
+#include "deborphan.h"
+
+#define CACHE_MAGIC "deborphan-cache 2"
+
+/* Flags of a cached package. */
+#define REC_INSTALL (1 << 0)
+#define REC_HOLD (1 << 1)
+#define REC_ESSENTIAL (1 << 2)
+#define REC_DUMMY (1 << 3)
+#define REC_CONFIG (1 << 4)
+
+static unsigned long long fp_add(unsigned long long fp,
+                                 const void* buf,
+                                 size_t len) {
+    return (fp ^ memhash(buf, len)) * 0x100000001b3ULL;
+}
+
+/* Everything that changes how a stanza is parsed, or whether the
+ * package makes it into the list.
+ */
+static unsigned long long parse_fingerprint(const context* ctx) {
+    int o[] = {ctx->options[IGNORE_RECOMMENDS], ctx->options[IGNORE_SUGGESTS],
+               ctx->options[FORCE_HOLD], ctx->options[FIND_CONFIG],
+               guess_chk(ctx, GUESS_DUMMY)};
+    unsigned long long fp = memhash(o, sizeof(o));
+    size_t i;
+
+    for (i = 0; i < ctx->exclude_list_cnt; i++)
+        fp = fp_add(fp, ctx->exclude_list[i].name,
+                    strlen(ctx->exclude_list[i].name));
+
+    return fp;
+}
+
+/* Everything that changes the verdict on an unchanged package. */
+static unsigned long long check_fingerprint(const context* ctx) {
+    unsigned long long fp = memhash(ctx->options, sizeof(ctx->options));
+    dep* k;
+
+    for (k = ctx->keep.names; k && k->name; k++)
+        fp = fp_add(fp, k->name, strlen(k->name));
+
+    return fp;
+}
+
+static void free_rec(stanza_rec* rec) {
+    reinit_pkg(&rec->pkg);
+    free(rec);
+}
+
+void snapshot_init(snapshot* s, context* ctx) {
+    memset(s, 0, sizeof(snapshot));
+    s->ctx = ctx;
+    hash_init(&s->byhash, 0);
+    hash_init(&s->rdeps, 0);
+}
+
+void snapshot_free(snapshot* s) {
+    stanza_rec* next;
+
+    for (; s->recs; s->recs = next) {
+        next = s->recs->next;
+        free_rec(s->recs);
+    }
+    hash_free(&s->byhash);
+    name_ref_free_all(&s->rdeps);
+}
+
+static void index_recs(snapshot* s) {
+    stanza_rec* rec;
+    size_t n = 0;
+
+    for (rec = s->recs; rec; rec = rec->next)
+        n++;
+
+    hash_free(&s->byhash);
+    hash_init(&s->byhash, n);
+    for (rec = s->recs; rec; rec = rec->next)
+        hash_add(&s->byhash, rec->hash, rec);
+}
+
+/* Count (delta = 1) or uncount (delta = -1) the dependencies of rec. A
+ * name whose count drops to or rises from zero is marked dirty. Returns
+ * -1 if there is no memory for a name that is new.
+ */
+static int count_deps(snapshot* s, stanza_rec* rec, int delta) {
+    int i;
+
+    if (!rec->inlist)
+        return 0;
+
+    for (i = 0; i < rec->pkg.deps_cnt; i++) {
+        name_ref* r = name_ref_get(&s->rdeps, rec->pkg.deps[i].name);
+        if (!r)
+            return -1;
+        if (r->count == 0 || r->count + delta == 0)
+            r->dirty = 1;
+        r->count += delta;
+    }
+
+    return 0;
+}
+
+static int is_needed(const snapshot* s, const dep* d) {
+    name_ref* r = name_ref_find(&s->rdeps, d->name);
+    return r && r->count > 0;
+}
+
+static int is_dirty(const snapshot* s, const pkg_info* p) {
+    name_ref* r;
+    int i;
+
+    if (!p->self.name)
+        return 0;
+    if ((r = name_ref_find(&s->rdeps, p->self.name)) && r->dirty)
+        return 1;
+    for (i = 0; i < p->provides_cnt; i++)
+        if ((r = name_ref_find(&s->rdeps, p->provides[i].name)) && r->dirty)
+            return 1;
+
+    return 0;
+}
+
+int rec_verdict(const snapshot* s, stanza_rec* rec) {
+    int i;
+
+    if (!rec->inlist || !rec->pkg.self.name)
+        return 0;
+    if (!is_candidate(s->ctx, &rec->pkg))
+        return 0;
+    if (needs_dependents_check(&rec->pkg)) {
+        if (is_needed(s, &rec->pkg.self))
+            return 0;
+        for (i = 0; i < rec->pkg.provides_cnt; i++)
+            if (is_needed(s, &rec->pkg.provides[i]))
+                return 0;
+    }
+
+    return is_reported(s->ctx, &rec->pkg);
+}
+
+static void clear_dirty(snapshot* s) {
+    size_t i;
+
+    for (i = 0; s->rdeps.slots && i <= s->rdeps.mask; i++) {
+        name_ref* r = s->rdeps.slots[i].value;
+        if (r)
+            r->dirty = 0;
+    }
+}
+
+static int rec_unseen(const void* value, const void* key) {
+    const stanza_rec* rec = value;
+    return !rec->seen && rec->len == *(const size_t*)key;
+}
+
+/* Bring the snapshot up to date with the status file in content.
+ * Returns -1 and sets errno if that fails: to EBADMSG if content can't be
+ * used, see context.bad_status, and to ENOMEM if memory ran out while it
+ * was parsed. The snapshot is then left as it was. If memory runs out
+ * later on, it is emptied, and the next update starts over.
+ */
+int snapshot_update(snapshot* s, char* content) {
+    context* ctx = s->ctx;
+    unsigned long long parse_fp = parse_fingerprint(ctx);
+    unsigned long long check_fp = check_fingerprint(ctx);
+    stanza_rec *rec, *next, *head = NULL, **tail = &head;
+    char *stanza, *firstarch = NULL;
+    int recheck_all, dummy = 0, err = 0;
+    snapshot old = *s;
+    size_t len;
+
+    ctx->bad_status = STATUS_OK;
+    if (parse_fp != s->parse_fp) {
+        /* The cached packages were parsed differently; start over, but
+         * keep them until content turns out to be good. */
+        snapshot_init(s, ctx);
+        s->parse_fp = parse_fp;
+    }
+    recheck_all = check_fp != s->check_fp;
+    s->reparsed = s->rechecked = 0;
+
+    for (rec = s->recs; rec; rec = rec->next)
+        rec->seen = rec->fresh = 0;
+
+    while ((stanza = next_stanza(&content, &len)) != NULL) {
+        unsigned long long h = memhash(stanza, len);
+
+        if ((rec = hash_find(&s->byhash, h, rec_unseen, &len)) == NULL) {
+            if (!(rec = calloc(1, sizeof(stanza_rec)))) {
+                err = ENOMEM;
+                break;
+            }
+            rec->hash = h;
+            rec->len = len;
+            rec->fresh = 1;
+            get_pkg_stanza(ctx, stanza, &rec->pkg, &dummy);
+            rec->inlist = (rec->pkg.install || ctx->options[FIND_CONFIG]) &&
+                          !is_excluded(ctx, &rec->pkg.self);
+            s->reparsed++;
+        }
+        rec->seen = 1;
+        *tail = rec;
+        tail = &rec->next_seen;
+        if (ctx->bad_status) {
+            err = EBADMSG;
+            break;
+        }
+    }
+    *tail = NULL;
+
+    if (err) {
+        /* Only the records parsed now are dropped. */
+        for (rec = head; rec; rec = next) {
+            next = rec->next_seen;
+            if (rec->fresh)
+                free_rec(rec);
+        }
+        if (s->parse_fp != old.parse_fp)
+            snapshot_free(s);
+        *s = old;
+        errno = err;
+        return -1;
+    }
+    if (s->parse_fp != old.parse_fp)
+        snapshot_free(&old);
+    s->check_fp = check_fp;
+
+    /* Whatever was not seen is gone. */
+    for (rec = s->recs; rec; rec = next) {
+        next = rec->next;
+        if (!rec->seen) {
+            count_deps(s, rec, -1);
+            free_rec(rec);
+        }
+    }
+    for (rec = head; rec; rec = rec->next_seen) {
+        rec->next = rec->next_seen;
+        if (rec->fresh && !err && count_deps(s, rec, 1) < 0)
+            err = ENOMEM;
+    }
+    s->recs = head;
+    if (err) {
+        snapshot_free(s);
+        snapshot_init(s, ctx);
+        errno = err;
+        return -1;
+    }
+    index_recs(s);
+
+    s->multiarch = 0;
+    for (rec = s->recs; rec; rec = rec->next) {
+        int recheck = recheck_all || rec->fresh || is_dirty(s, &rec->pkg);
+
+        /* extended_states changes without the stanza changing. */
+        if (ctx->options[AUTO_ONLY] && rec->inlist) {
+            int is_auto = is_auto_installed(ctx, &rec->pkg.self);
+            if (is_auto != rec->pkg.auto_installed) {
+                rec->pkg.auto_installed = is_auto;
+                recheck = 1;
+            }
+        }
+
+        if (recheck) {
+            rec->orphan = rec_verdict(s, rec);
+            s->rechecked++;
+        }
+
+        /* Same as in get_pkg_info(). */
+        if (!s->multiarch && rec->pkg.self.arch &&
+            strcmp(rec->pkg.self.arch, "all") != 0) {
+            if (!firstarch)
+                firstarch = rec->pkg.self.arch;
+            else if (strcmp(firstarch, rec->pkg.self.arch) != 0)
+                s->multiarch = 1;
+        }
+    }
+
+    clear_dirty(s);
+
+    return 0;
+}
+
+/* Check every package again, e.g. after the keep list changed. */
+void snapshot_recheck(snapshot* s) {
+    stanza_rec* rec;
+
+    s->check_fp = check_fingerprint(s->ctx);
+    for (rec = s->recs; rec; rec = rec->next)
+        rec->orphan = rec_verdict(s, rec);
+}
+
+void snapshot_print(const snapshot* s) {
+    const context* ctx = s->ctx;
+    int print_suffix = (ctx->options[SHOW_ARCH] == ALWAYS ||
+                        (ctx->options[SHOW_ARCH] == DEFAULT && s->multiarch));
+    stanza_rec* rec;
+
+    for (rec = s->recs; rec; rec = rec->next)
+        if (rec->orphan)
+            print_orphan(ctx, &rec->pkg, print_suffix);
+}
+
+/* Run a full analysis on content and compare it to the snapshot.
+ * Returns the number of differences found.
+ */
+int snapshot_verify(const snapshot* s, char* content) {
+    pkg_info *package, *this;
+    stanza_rec* rec = s->recs;
+    int multiarch = 0, bad = 0;
+
+    package = read_status(s->ctx, content, &multiarch);
+
+    for (this = package; this->next; this = this->next) {
+        int full = is_candidate(s->ctx, this) &&
+                   (!needs_dependents_check(this) ||
+                    !has_dependents(package, this)) &&
+                   is_reported(s->ctx, this);
+
+        while (rec && !rec->inlist)
+            rec = rec->next;
+        if (!rec) {
+            fprintf(stderr, "%s: cache: %s is missing\n", program_name,
+                    this->self.name);
+            bad++;
+            break;
+        }
+        if (rec->orphan != full) {
+            fprintf(stderr, "%s: cache: %s is %sreported by a full run\n",
+                    program_name, this->self.name, full ? "" : "not ");
+            bad++;
+        }
+        rec = rec->next;
+    }
+    while (rec && !rec->inlist)
+        rec = rec->next;
+    if (rec) {
+        fprintf(stderr, "%s: cache: %s should not be there\n", program_name,
+                rec->pkg.self.name);
+        bad++;
+    }
+    if (s->multiarch != multiarch) {
+        fprintf(stderr, "%s: cache: multiarch detection differs\n",
+                program_name);
+        bad++;
+    }
+
+    free_pkg_list(package);
+
+    return bad;
+}
+
+/* The cache file has a header line and then one line per stanza, with
+ * tab separated fields:
+ *
+ *   hash len inlist orphan flags priority size name arch section
+ *   provides deps
+ *
+ * Missing strings are written as "-", lists as "count:item,item,...".
+ */
+static const char* str_or_dash(const char* s) {
+    return s ? s : "-";
+}
+
+static char* dash_to_null(char* s) {
+    return strcmp(s, "-") == 0 ? NULL : s;
+}
+
+static int is_writable(const char* s) {
+    return !s || !strpbrk(s, "\t\n,");
+}
+
+static void write_list(FILE* fp, const dep* list, int cnt) {
+    int i;
+
+    fprintf(fp, "\t%d:", cnt);
+    for (i = 0; i < cnt; i++)
+        fprintf(fp, "%s%s", i ? "," : "", list[i].name);
+}
+
+int snapshot_save(const snapshot* s, const char* cfile) {
+    stanza_rec* rec;
+    char* tmp;
+    FILE* fp;
+    mode_t mask;
+    int fd, i, ok;
+
+    if (!(tmp = malloc(strlen(cfile) + sizeof(".XXXXXX"))))
+        return -1;
+    strcpy(tmp, cfile);
+    strcat(tmp, ".XXXXXX");
+
+    /* A name of its own, so that runs sharing the cache don't write
+     * into each other's file, nor follow a link planted there. */
+    if ((fd = mkstemp(tmp)) < 0 || !(fp = fdopen(fd, "w"))) {
+        i = errno;
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp);
+        }
+        free(tmp);
+        errno = i;
+        return -1;
+    }
+    /* As if it had been created by fopen(). */
+    mask = umask(0);
+    umask(mask);
+    fchmod(fd, 0666 & ~mask);
+
+    fprintf(fp, "%s\t%llx\t%llx\n", CACHE_MAGIC, s->parse_fp, s->check_fp);
+
+    for (rec = s->recs; rec; rec = rec->next) {
+        pkg_info* p = &rec->pkg;
+
+        ok = is_writable(p->self.name) && is_writable(p->self.arch) &&
+             is_writable(p->section);
+        for (i = 0; ok && i < p->provides_cnt; i++)
+            ok = is_writable(p->provides[i].name);
+        for (i = 0; ok && i < p->deps_cnt; i++)
+            ok = is_writable(p->deps[i].name);
+        /* Not representable, it will simply be parsed again. */
+        if (!ok)
+            continue;
+
+        fprintf(fp, "%llx\t%zu\t%d\t%d\t%d\t%d\t%ld\t%s\t%s\t%s", rec->hash,
+                rec->len, rec->inlist, rec->orphan,
+                (p->install ? REC_INSTALL : 0) | (p->hold ? REC_HOLD : 0) |
+                    (p->essential ? REC_ESSENTIAL : 0) |
+                    (p->dummy ? REC_DUMMY : 0) | (p->config ? REC_CONFIG : 0),
+                p->priority, p->installed_size, str_or_dash(p->self.name),
+                str_or_dash(p->self.arch), str_or_dash(p->section));
+        write_list(fp, p->provides, p->provides_cnt);
+        write_list(fp, p->deps, p->deps_cnt);
+        fputc('\n', fp);
+    }
+
+    if (ferror(fp) | fclose(fp) || rename(tmp, cfile) < 0) {
+        i = errno;
+        unlink(tmp);
+        free(tmp);
+        errno = i;
+        return -1;
+    }
+
+    free(tmp);
+    return 0;
+}
+
+static void add_dep(pkg_info* p, const char* name) {
+    if (p->deps_cnt >= p->deps_max) {
+        p->deps_max = p->deps_max ? p->deps_max * 2 : INIT_DEPENDS_COUNT;
+        p->deps = realloc(p->deps, p->deps_max * sizeof(p->deps[0]));
+    }
+    set_dep(&p->deps[p->deps_cnt++], name);
+}
+
+/* Read a "count:item,item,..." list, calling add for every item. */
+static int read_list(char* field, pkg_info* p, int provides) {
+    char* item;
+    long n, i;
+
+    n = strtol(field, &field, 10);
+    if (n < 0 || *field != ':')
+        return -1;
+    field++;
+
+    for (i = 0; i < n; i++) {
+        if (!(item = strsep(&field, ",")))
+            return -1;
+        if (provides)
+            set_provides(p, item, i);
+        else
+            add_dep(p, item);
+    }
+    if (provides)
+        p->provides_cnt = n;
+
+    return 0;
+}
+
+static stanza_rec* read_rec(char* line) {
+    char* f[12];
+    stanza_rec* rec;
+    int i, flags;
+
+    for (i = 0; i < 12; i++)
+        if (!(f[i] = strsep(&line, "\t")))
+            return NULL;
+    if (line)
+        return NULL;
+
+    rec = calloc(1, sizeof(stanza_rec));
+    rec->hash = strtoull(f[0], NULL, 16);
+    rec->len = strtoul(f[1], NULL, 10);
+    rec->inlist = atoi(f[2]);
+    rec->orphan = atoi(f[3]);
+    flags = atoi(f[4]);
+    rec->pkg.install = !!(flags & REC_INSTALL);
+    rec->pkg.hold = !!(flags & REC_HOLD);
+    rec->pkg.essential = !!(flags & REC_ESSENTIAL);
+    rec->pkg.dummy = !!(flags & REC_DUMMY);
+    rec->pkg.config = !!(flags & REC_CONFIG);
+    rec->pkg.priority = atoi(f[5]);
+    rec->pkg.installed_size = strtol(f[6], NULL, 10);
+    if (dash_to_null(f[7])) {
+        rec->pkg.self.name = strdup(f[7]);
+        rec->pkg.self.namehash = strhash(f[7]);
+    }
+    if (dash_to_null(f[8]))
+        rec->pkg.self.arch = strdup(f[8]);
+    if (dash_to_null(f[9]))
+        rec->pkg.section = strdup(f[9]);
+
+    if (read_list(f[10], &rec->pkg, 1) < 0 ||
+        read_list(f[11], &rec->pkg, 0) < 0) {
+        free_rec(rec);
+        return NULL;
+    }
+
+    return rec;
+}
+
+/* Load the snapshot written by snapshot_save(). A cache file that can't
+ * be read leaves the snapshot empty, so everything is parsed afresh.
+ */
+int snapshot_load(snapshot* s, const char* cfile) {
+    char *content, *buf, *line;
+    stanza_rec *rec, **tail = &s->recs;
+
+    if (!(content = debopen(cfile)))
+        return -1;
+
+    buf = content;
+    line = strsep(&buf, "\n");
+    if (strncmp(line, CACHE_MAGIC "\t", sizeof(CACHE_MAGIC)) != 0 ||
+        sscanf(line + sizeof(CACHE_MAGIC), "%llx\t%llx", &s->parse_fp,
+               &s->check_fp) != 2)
+        goto invalid;
+
+    while ((line = strsep(&buf, "\n")) != NULL) {
+        if (*line == '\0')
+            continue;
+        if (!(rec = read_rec(line)))
+            goto invalid;
+        *tail = rec;
+        tail = &rec->next;
+    }
+
+    free(content);
+
+    for (rec = s->recs; rec; rec = rec->next)
+        count_deps(s, rec, 1);
+    clear_dirty(s);
+    index_recs(s);
+
+    return 0;
+
+invalid:
+    free(content);
+    snapshot_free(s);
+    snapshot_init(s, s->ctx);
+    errno = EINVAL;
+    return -1;
+}
+
+static int key_eq(const void* value, const void* key) {
+    return strcmp(*(char* const*)value, (const char*)key) == 0;
+}
+
+/* Copy the orphans of the snapshot, so they outlive its next update. */
+void collect_orphans(const snapshot* s, orphan_set* set) {
+    stanza_rec* rec;
+    size_t n = 0;
+
+    for (rec = s->recs; rec; rec = rec->next)
+        n += rec->orphan;
+
+    set->keys = malloc((n + 1) * sizeof(char*));
+    set->namelen = malloc((n + 1) * sizeof(size_t));
+    set->sizes = malloc((n + 1) * sizeof(long));
+    set->cnt = 0;
+    hash_init(&set->idx, n);
+
+    for (rec = s->recs; rec; rec = rec->next) {
+        const dep* self = &rec->pkg.self;
+        char* key;
+
+        if (!rec->orphan)
+            continue;
+
+        set->namelen[set->cnt] = strlen(self->name);
+        key = malloc(set->namelen[set->cnt] +
+                     (self->arch ? strlen(self->arch) + 2 : 1));
+        strcpy(key, self->name);
+        if (self->arch) {
+            strcat(key, ":");
+            strcat(key, self->arch);
+        }
+        set->keys[set->cnt] = key;
+        set->sizes[set->cnt] = rec->pkg.installed_size;
+        hash_add(&set->idx, memhash(key, strlen(key)), &set->keys[set->cnt]);
+        set->cnt++;
+    }
+}
+
+void free_orphans(orphan_set* set) {
+    size_t i;
+
+    for (i = 0; i < set->cnt; i++)
+        free(set->keys[i]);
+    free(set->keys);
+    free(set->namelen);
+    free(set->sizes);
+    hash_free(&set->idx);
+    memset(set, 0, sizeof(orphan_set));
+}
+
+int orphan_set_has(const orphan_set* set, const char* key) {
+    return hash_find(&set->idx, memhash(key, strlen(key)), key_eq, key) !=
+           NULL;
+}
+
+/* Print the members of a that are not in b, as changes prefixed by sign,
+ * for --diff and --watch. */
+void print_missing(const context* ctx,
+                   const orphan_set* a,
+                   const orphan_set* b,
+                   int sign,
+                   int print_suffix) {
+    size_t i;
+
+    for (i = 0; i < a->cnt; i++) {
+        char* key = a->keys[i];
+        char* arch = NULL;
+
+        if (orphan_set_has(b, key))
+            continue;
+        if (key[a->namelen[i]] == ':') {
+            key[a->namelen[i]] = '\0';
+            arch = key + a->namelen[i] + 1;
+        }
+        print_change(ctx, sign, key, arch, a->sizes[i], print_suffix);
+        if (arch)
+            arch[-1] = ':';
+    }
+}
+
+int run_incremental(context* ctx, char* content, const char* cfile) {
+    char* copy = NULL;
+    snapshot s;
+    int bad = 0;
+
+    snapshot_init(&s, ctx);
+    if (snapshot_load(&s, cfile) < 0 && errno != ENOENT)
+        fprintf(stderr, "%s: %s: %s, ignoring it\n", program_name, cfile,
+                strerror(errno));
+
+    if (ctx->options[VERIFY_CACHE])
+        copy = strdup(content);
+
+    if (snapshot_update(&s, content) < 0) {
+        if (errno == EBADMSG)
+            exit_bad_status(ctx->bad_status);
+        error(EXIT_FAILURE, errno, "%s", cfile);
+    }
+    snapshot_print(&s);
+    print_done(ctx);
+
+#ifdef DEBUG
+    fprintf(stderr, "Reparsed %d stanzas, rechecked %d packages.\n",
+            s.reparsed, s.rechecked);
+#endif /* DEBUG */
+
+    if (copy) {
+        bad = snapshot_verify(&s, copy);
+        free(copy);
+        if (bad)
+            fprintf(stderr, "%s: %s: %d differences to a full run\n",
+                    program_name, cfile, bad);
+    }
+
+    /* Don't keep a cache that is known to be wrong. */
+    if (bad)
+        unlink(cfile);
+    else if (snapshot_save(&s, cfile) < 0)
+        fprintf(stderr, "%s: %s: %s\n", program_name, cfile, strerror(errno));
+
+    snapshot_free(&s);
+
+    return bad;
+}
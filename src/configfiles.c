@@ -0,0 +1,165 @@
+/* configfiles.c - Finding what is left of removed packages for deborphan.
+
+   Distributed under the terms of the MIT License, see the
+   file COPYING provided in this package for details.
+*/
+
+/* With --find-config, the only question is which packages are in the
+ * config-files state: dpkg keeps no dependencies for them, and they are
+ * reported whatever depends on them. So unless --show-deps asks what
+ * does, the status file is gone through once, as it is read, and only
+ * the fields naming a package, its state, architecture, priority,
+ * section and size are parsed. No dependency is ever stored.
+ *
+ * Whether to print architectures is only known at the end of the file,
+ * so the packages found are kept until then. There are few of them, and
+ * nothing but those fields is kept of them.
+ */
+
+#include <errno.h>
+#include <set.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "deborphan.h"
+
+/* Package, Priority, Architecture, Status, Section and Installed-Size,
+ * see get_pkg_info(). */
+static int is_wanted(const char* line) {
+    switch (upcase(line[0])) {
+        case 'A':
+        case 'I':
+            return 1;
+        case 'P':
+            return line[1] &&
+                   (upcase(line[2]) == 'C' || upcase(line[2]) == 'I');
+        case 'S':
+            return upcase(line[1]) == 'E' || upcase(line[1]) == 'T';
+    }
+
+    return 0;
+}
+
+static void get_config_stanza(context* ctx,
+                              char* stanza,
+                              pkg_info* package,
+                              int* multiarch) {
+    char* line;
+
+    while ((line = strsep(&stanza, "\n")) != NULL) {
+        if (!is_wanted(line))
+            continue;
+        strstripchr(line, ' ');
+        get_pkg_info(ctx, line, package, multiarch);
+    }
+}
+
+typedef struct found_list {
+    pkg_info** pkgs;
+    size_t cnt;
+    size_t max;
+} found_list;
+
+/* Parse one stanza into *pkg, and keep it in found if it is reported.
+ * *pkg is then replaced by a new package. */
+static void check_stanza(context* ctx,
+                         char* stanza,
+                         pkg_info** pkg,
+                         found_list* found,
+                         int* multiarch) {
+    pkg_info* p = *pkg;
+
+    get_config_stanza(ctx, stanza, p, multiarch);
+
+    if (!p->config || is_excluded(ctx, &p->self)) {
+        reinit_pkg(p);
+        return;
+    }
+    if (ctx->options[AUTO_ONLY])
+        p->auto_installed = is_auto_installed(ctx, &p->self);
+    if (candidate_reason(ctx, p) || !is_reported(ctx, p)) {
+        reinit_pkg(p);
+        return;
+    }
+
+    if (found->cnt == found->max) {
+        found->max = found->max ? found->max * 2 : 64;
+        found->pkgs = realloc(found->pkgs, found->max * sizeof(pkg_info*));
+        if (!found->pkgs)
+            error(EXIT_FAILURE, errno, "find-config");
+    }
+    found->pkgs[found->cnt++] = p;
+    if (!(*pkg = malloc(sizeof(pkg_info))))
+        error(EXIT_FAILURE, errno, "find-config");
+    init_pkg(*pkg);
+}
+
+/* Print the packages of sfile of which only the configuration files
+ * are left, in one pass over it. Returns -1 if it can't be read.
+ */
+int run_find_config(context* ctx, const char* sfile) {
+    found_list found = {NULL, 0, 0};
+    pkg_info* pkg;
+    char *stanza, *content = NULL, *next;
+    stanza_reader* r = NULL;
+    size_t len, i;
+    int multiarch = 0, print_suffix, err = 0;
+
+    /* Laying dpkg's journal over the file needs all of it. */
+    if (status_has_updates(sfile)) {
+        if (!(content = debopen_status(sfile)))
+            return -1;
+    } else if (!(r = reader_open(sfile, !ctx->options[LOW_IMPACT]))) {
+        return -1;
+    }
+
+    pkg = malloc(sizeof(pkg_info));
+    init_pkg(pkg);
+
+    ctx->bad_status = STATUS_OK;
+    if (content) {
+        next = content;
+        while (!ctx->bad_status &&
+               (stanza = next_stanza(&next, &len)) != NULL)
+            check_stanza(ctx, stanza, &pkg, &found, &multiarch);
+        free(content);
+    } else {
+        while (!ctx->bad_status && (stanza = reader_next(r, &len)) != NULL)
+            check_stanza(ctx, stanza, &pkg, &found, &multiarch);
+        err = reader_error(r);
+        reader_close(r);
+    }
+    reinit_pkg(pkg);
+    free(pkg);
+    if (ctx->bad_status)
+        exit_bad_status(ctx->bad_status);
+    forget_file(ctx, sfile);
+
+    if (!err) {
+        print_suffix = (ctx->options[SHOW_ARCH] == ALWAYS ||
+                        (ctx->options[SHOW_ARCH] == DEFAULT && multiarch));
+        if (ctx->options[PURGE_LIST]) {
+            print_purge_list(found.pkgs, found.cnt, print_suffix);
+        } else {
+            print_header(ctx);
+            for (i = 0; i < found.cnt; i++)
+                print_orphan(ctx, found.pkgs[i], print_suffix);
+        }
+        print_done(ctx);
+    }
+
+    for (i = 0; i < found.cnt; i++) {
+        reinit_pkg(found.pkgs[i]);
+        free(found.pkgs[i]);
+    }
+    free(found.pkgs);
+
+    if (err) {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,84 @@
+/* context.c - The state of one analysis for deborphan.
+
+   Distributed under the terms of the MIT License, see the
+   file COPYING provided in this package for details.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "deborphan.h"
+
+/* Set ctx up with the default options and nothing to keep, search for
+ * or exclude.
+ */
+void context_init(context* ctx) {
+    memset(ctx, 0, sizeof(context));
+
+    ctx->options[PRIORITY] = DEFAULT_PRIORITY;
+#ifdef IGNORE_DEBFOSTER
+    ctx->options[NO_DEBFOSTER] = 1;
+#endif
+}
+
+void context_free(context* ctx) {
+    keep_free(&ctx->keep);
+    free(ctx->search_for.found);
+    free(ctx->search_for.next_same);
+    hash_free(&ctx->search_for.idx);
+    free(ctx->exclude_list);
+    free_extended_states(ctx);
+    free(ctx->firstarch);
+    free_pkg_regex(ctx);
+    memset(ctx, 0, sizeof(context));
+}
+
+static int depcmp(const dep* d1, const dep* d2) {
+    return strcmp(d1->name, d2->name);
+}
+
+/* Add name, which is not copied, to the packages to treat as if they
+ * were not installed. An architecture suffix is cut off. Returns -1 if
+ * there is no memory for it.
+ */
+int add_exclude(context* ctx, char* name) {
+    dep d, *list;
+    size_t i;
+
+    if (ctx->exclude_list_cnt >= ctx->exclude_list_max) {
+        /* grow exclude_list[] array */
+        size_t max = ctx->exclude_list_max ? ctx->exclude_list_max * 2
+                                           : INIT_EXCLUDES_COUNT;
+#ifdef DEBUG
+        fprintf(stderr, "Growing excludes field to %zu.\n", max);
+        fflush(stderr);
+#endif /* DEBUG */
+        list = realloc(ctx->exclude_list, max * sizeof(ctx->exclude_list[0]));
+        if (!list)
+            return -1;
+        ctx->exclude_list = list;
+        ctx->exclude_list_max = max;
+    }
+
+    name[strcspn(name, ":")] = '\0'; /* remove architecture suffix */
+    d.name = name;
+    d.arch = NULL;
+    d.namehash = strhash(name);
+
+    /* Keep the list sorted. */
+    for (i = ctx->exclude_list_cnt;
+         i > 0 && depcmp(&ctx->exclude_list[i - 1], &d) > 0; i--)
+        ctx->exclude_list[i] = ctx->exclude_list[i - 1];
+    ctx->exclude_list[i] = d;
+    ctx->exclude_list_cnt++;
+
+    return 0;
+}
+
+int is_excluded(const context* ctx, const dep* d) {
+    return d->name && ctx->exclude_list &&
+           bsearch(d, ctx->exclude_list, ctx->exclude_list_cnt,
+                   sizeof(ctx->exclude_list[0]),
+                   (int (*)(const void*, const void*))depcmp);
+}
@@ -8,12 +8,15 @@
 */
 
 /* Header files we should all have. */
+#include <cache.h>
 #include <errno.h>
 #include <getopt.h>
+#include <limits.h>
 #include <set.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "config.h"
 #include "deborphan.h"
@@ -25,41 +28,122 @@
 #include <locale.h>
 #endif
 
-/* Name this program was called with. */
-char* program_name;
-
-/* Options given on the commandline */
-int options[NUM_OPTIONS];
-
-/* An optional list of packages to search for. */
-dep* search_for;
+/* What is given on the command line, as far as the options that can't be
+ * used together are concerned. The order is the one in which a clash is
+ * reported. */
+enum {
+    GIVEN_STATUS_FILE = 1 << 0,
+    GIVEN_KEEP_FILE = 1 << 1,
+    GIVEN_EXTENDED_STATES = 1 << 2,
+    GIVEN_ROOT = 1 << 3,
+    GIVEN_FLEET = 1 << 4,
+    GIVEN_DIFF = 1 << 5,
+    GIVEN_CACHE_FILE = 1 << 6,
+    GIVEN_SERVE = 1 << 7,
+    GIVEN_WATCH = 1 << 8,
+    GIVEN_SHOW_DEPS = 1 << 9,
+    GIVEN_AUTO_ONLY = 1 << 10,
+    GIVEN_LOW_MEMORY = 1 << 11,
+    GIVEN_PURGE_LIST = 1 << 12,
+    GIVEN_EXPLAIN_FILTER = 1 << 13,
+    GIVEN_FORMAT = 1 << 14,
+    GIVEN_KEEP_MGMT = 1 << 15,
+    GIVEN_PACKAGES = 1 << 16,
+    GIVEN_NUL = 1 << 17
+};
+
+static const char* const given_names[] = {"--status-file",
+                                          "--keep-file",
+                                          "--extended-states",
+                                          "--root",
+                                          "--fleet",
+                                          "--diff",
+                                          "--cache-file",
+                                          "--serve",
+                                          "--watch",
+                                          "--show-deps",
+                                          "--auto-only",
+                                          "--low-memory",
+                                          "--purge-list",
+                                          "--explain-filter",
+                                          "--format",
+                                          "keep file management",
+                                          "package names",
+                                          "--format=nul"};
+
+/* Each mode, and what it can't be used with. */
+static const struct {
+    int mode;
+    int clashes;
+} exclusive[] = {
+    {GIVEN_ROOT, GIVEN_STATUS_FILE | GIVEN_KEEP_FILE |
+                     GIVEN_EXTENDED_STATES | GIVEN_CACHE_FILE | GIVEN_SERVE |
+                     GIVEN_WATCH | GIVEN_KEEP_MGMT | GIVEN_PACKAGES},
+    {GIVEN_FLEET, GIVEN_STATUS_FILE | GIVEN_ROOT | GIVEN_CACHE_FILE |
+                      GIVEN_SERVE | GIVEN_WATCH | GIVEN_SHOW_DEPS |
+                      GIVEN_AUTO_ONLY | GIVEN_KEEP_MGMT | GIVEN_PACKAGES},
+    {GIVEN_DIFF, GIVEN_STATUS_FILE | GIVEN_ROOT | GIVEN_FLEET |
+                     GIVEN_CACHE_FILE | GIVEN_SERVE | GIVEN_WATCH |
+                     GIVEN_SHOW_DEPS | GIVEN_KEEP_MGMT},
+    {GIVEN_LOW_MEMORY, GIVEN_ROOT | GIVEN_FLEET | GIVEN_DIFF |
+                           GIVEN_CACHE_FILE | GIVEN_SERVE | GIVEN_WATCH |
+                           GIVEN_SHOW_DEPS | GIVEN_KEEP_MGMT |
+                           GIVEN_PACKAGES},
+    {GIVEN_PURGE_LIST, GIVEN_ROOT | GIVEN_FLEET | GIVEN_DIFF |
+                           GIVEN_CACHE_FILE | GIVEN_SERVE | GIVEN_WATCH |
+                           GIVEN_SHOW_DEPS | GIVEN_FORMAT | GIVEN_KEEP_MGMT |
+                           GIVEN_PACKAGES},
+    {GIVEN_EXPLAIN_FILTER, GIVEN_ROOT | GIVEN_FLEET | GIVEN_DIFF |
+                               GIVEN_CACHE_FILE | GIVEN_SERVE | GIVEN_WATCH |
+                               GIVEN_SHOW_DEPS | GIVEN_LOW_MEMORY |
+                               GIVEN_PURGE_LIST | GIVEN_KEEP_MGMT},
+    {GIVEN_SERVE, GIVEN_SHOW_DEPS},
+    {GIVEN_WATCH, GIVEN_SHOW_DEPS},
+    /* The names alone would not tell a package from its dependents. */
+    {GIVEN_NUL, GIVEN_SHOW_DEPS | GIVEN_PACKAGES},
+};
+
+/* The name of the first option in bits. */
+static const char* given_name(int bits) {
+    size_t i = 0;
+
+    while (!(bits & (1 << i)))
+        i++;
+
+    return given_names[i];
+}
 
-/* A bunch of packages to keep. */
-dep* keep;
+/* Exit if a mode in given is used with what it can't be. */
+static void check_exclusive(int given) {
+    size_t i;
+    int clash;
 
-static int depcmp(const dep* d1, const dep* d2) {
-    return strcmp(d1->name, d2->name);
+    for (i = 0; i < sizeof(exclusive) / sizeof(exclusive[0]); i++) {
+        if (!(given & exclusive[i].mode))
+            continue;
+        if ((clash = given & exclusive[i].clashes))
+            error(EXIT_FAILURE, 0, "%s can't be used with %s.",
+                  given_name(exclusive[i].mode), given_name(clash));
+    }
 }
 
 int main(int argc, char* argv[]) {
-    char *line, *sfile = NULL, *kfile = NULL;
-    char *sfile_content, *sfile_content2;
-    pkg_info *package, *this;
+    char *sfile = NULL, *kfile = NULL, *cfile = NULL, *sockpath = NULL;
+    char* fleetdir = NULL;
+    long ceiling = 0;
+    char* efile = NULL;
+    char* sfile_content;
+    pkg_info* package;
     int i, argind;
     size_t j;
     int multiarch = 0;
     int print_arch_suffixes;
-    size_t exclude_list_cnt = 0;
-    size_t exclude_list_max = 0;
-    dep* exclude_list = NULL;
+    char** roots = NULL;
+    int roots_cnt = 0, roots_max = 0;
+    context ctx;
 
     program_name = argv[0];
-    memset(options, 0, NUM_OPTIONS * sizeof(int));
-
-    options[PRIORITY] = DEFAULT_PRIORITY;
-#ifdef IGNORE_DEBFOSTER
-    options[NO_DEBFOSTER] = 1;
-#endif
+    context_init(&ctx);
 
     /*@unused@*/ /* Actually it is used but splint does not recognise this. */
     struct option longopts[] = {{"version", 0, 0, 'v'},
@@ -130,6 +214,22 @@ int main(int argc, char* argv[]) {
                                 {"no-guess-java", 0, 0, 51},
                                 {"exclude", 1, 0, 'e'},
                                 {"exclude-dev", 0, 0, 'D'},
+                                {"cache-file", 1, 0, 205},
+                                {"verify-cache", 0, 0, 206},
+                                {"watch", 0, 0, 207},
+                                {"serve", 1, 0, 208},
+                                {"auto-only", 0, 0, 209},
+                                {"extended-states", 1, 0, 210},
+                                {"format", 1, 0, 211},
+                                {"jobs", 1, 0, 'j'},
+                                {"root", 1, 0, 212},
+                                {"roots-from", 1, 0, 213},
+                                {"fleet", 1, 0, 214},
+                                {"diff", 0, 0, 215},
+                                {"low-memory", 0, 0, 216},
+                                {"low-impact", 2, 0, 217},
+                                {"purge-list", 0, 0, 218},
+                                {"explain-filter", 0, 0, 219},
                                 {0, 0, 0, 0}};
 
 #ifdef ENABLE_NLS
@@ -138,14 +238,14 @@ int main(int argc, char* argv[]) {
     textdomain(PACKAGE);
 #endif
 
-    while ((i = getopt_long(argc, argv, "p:advhe:nf:sPzHk:ARLZD", longopts,
+    while ((i = getopt_long(argc, argv, "p:advhe:nf:sPzHk:ARLZD0j:", longopts,
                             NULL)) != EOF) {
         switch (i) {
             case 'd':
-                options[SHOW_DEPS] = 1;
+                ctx.options[SHOW_DEPS] = 1;
                 break;
             case 'D':
-                options[IGNORE_LIBS] |= IGNORE_LIB_DEV;
+                ctx.options[IGNORE_LIBS] |= IGNORE_LIB_DEV;
                 break;
             case 'h':
                 exit_help();
@@ -158,20 +258,114 @@ int main(int argc, char* argv[]) {
                 strcpy(sfile, optarg);
                 break;
             case 203:
-                options[SHOW_ARCH] = ALWAYS;
+                ctx.options[SHOW_ARCH] = ALWAYS;
                 break;
             case 204:
-                options[SHOW_ARCH] = NEVER;
+                ctx.options[SHOW_ARCH] = NEVER;
+                break;
+            case 205:
+                cfile = optarg;
+                break;
+            case 206:
+                ctx.options[VERIFY_CACHE] = 1;
+                break;
+            case 207:
+                ctx.options[WATCH] = 1;
+                break;
+            case 208:
+                sockpath = optarg;
+                break;
+            case 209:
+                ctx.options[AUTO_ONLY] = 1;
+                break;
+            case 210:
+                efile = optarg;
+                break;
+            case 211:
+                if (strcmp(optarg, "text") == 0)
+                    ctx.options[FORMAT] = FORMAT_TEXT;
+                else if (strcmp(optarg, "jsonl") == 0)
+                    ctx.options[FORMAT] = FORMAT_JSONL;
+                else if (strcmp(optarg, "tsv") == 0)
+                    ctx.options[FORMAT] = FORMAT_TSV;
+                else if (strcmp(optarg, "nul") == 0)
+                    ctx.options[FORMAT] = FORMAT_NUL;
+                else
+                    error(EXIT_FAILURE, 0, "%s: unknown output format", optarg);
+                break;
+            case '0':
+                ctx.options[FORMAT] = FORMAT_NUL;
+                break;
+            case 212:
+            case 213: {
+                char *list = NULL, *next = optarg, *line;
+
+                if (i == 213 && !(next = list = debopen(optarg)))
+                    error(EXIT_FAILURE, errno, "%s", optarg);
+                /* The file has one root per line; '#' starts a comment. */
+                while ((line = strsep(&next, "\n"))) {
+                    line += strspn(line, " \t");
+                    if (i == 212 && !*line)
+                        error(EXIT_FAILURE, 0, "--root needs a directory.");
+                    if (i == 213 && (!*line || *line == '#'))
+                        continue;
+                    if (roots_cnt == roots_max) {
+                        roots_max = roots_max ? roots_max * 2 : 16;
+                        roots = realloc(roots, roots_max * sizeof(char*));
+                        if (!roots)
+                            error(EXIT_FAILURE, errno, "root");
+                    }
+                    roots[roots_cnt++] = strdup(line);
+                    if (i == 212)
+                        break;
+                }
+                free(list);
+                ctx.options[ROOTS] = 1;
+                break;
+            }
+            case 214:
+                fleetdir = optarg;
+                ctx.options[FLEET] = 1;
+                break;
+            case 215:
+                ctx.options[DIFF] = 1;
+                break;
+            case 216:
+                ctx.options[LOW_MEMORY] = 1;
+                break;
+            case 217:
+                ctx.options[LOW_IMPACT] = 1;
+                if (optarg && (ceiling = parse_size(optarg)) <= 0)
+                    error(EXIT_FAILURE, 0, "%s: invalid memory ceiling",
+                          optarg);
                 break;
+            case 218:
+                ctx.options[PURGE_LIST] = 1;
+                break;
+            case 219:
+                ctx.options[EXPLAIN_FILTER] = 1;
+                break;
+            case 'j': {
+                char* end;
+                long n;
+
+                errno = 0;
+                n = strtol(optarg, &end, 10);
+                if (errno || end == optarg || *end || n < 0 || n > INT_MAX)
+                    error(EXIT_FAILURE, 0, "invalid number of jobs: %s",
+                          optarg);
+                ctx.options[JOBS] = n ? n : sysconf(_SC_NPROCESSORS_ONLN);
+                break;
+            }
             case 'n':
-                options[IGNORE_RECOMMENDS] = 1;
-                options[IGNORE_SUGGESTS] = 1;
+                ctx.options[IGNORE_RECOMMENDS] = 1;
+                ctx.options[IGNORE_SUGGESTS] = 1;
                 break;
             case 61:
-                options[IGNORE_RECOMMENDS] = 1;
+                ctx.options[IGNORE_RECOMMENDS] = 1;
                 break;
             case 62:
-                options[IGNORE_SUGGESTS] = 1;
+                ctx.options[IGNORE_SUGGESTS] = 1;
                 break;
             case 200:
                 printf(
@@ -180,224 +374,245 @@ int main(int argc, char* argv[]) {
                     "\nperl\npike\npython\nruby\nsection\n");
                 exit(EXIT_SUCCESS);
             case 201:
-                options[CHECK_OPTIONS] = 1;
+                ctx.options[CHECK_OPTIONS] = 1;
                 break;
             case 202:
                 /* ALL_PACKAGES_IMPLY_SECTION is defined anyway, so this
                  * fall through is sufficient for now. */
             case 'a':
-                options[ALL_PACKAGES] = 1;
+                ctx.options[ALL_PACKAGES] = 1;
 #ifdef ALL_PACKAGES_IMPLY_SECTION
-                options[SHOW_SECTION]++;
+                ctx.options[SHOW_SECTION]++;
 #endif
                 break;
             case 'p':
-                options[PRIORITY] = string_to_priority(optarg);
-                if (!options[PRIORITY]) {
-                    if (!sscanf(optarg, "%d", &options[PRIORITY])) {
+                ctx.options[PRIORITY] = string_to_priority(optarg);
+                if (!ctx.options[PRIORITY]) {
+                    if (!sscanf(optarg, "%d", &ctx.options[PRIORITY])) {
                         print_usage(stderr);
                         error(EXIT_FAILURE, 0, "invalid priority: %s", optarg);
                     }
                 }
                 break;
             case 's':
-                options[SHOW_SECTION]++;
+                ctx.options[SHOW_SECTION]++;
                 break;
             case 0:
-                options[SHOW_SECTION]--;
+                ctx.options[SHOW_SECTION]--;
                 break;
             case 'P':
-                options[SHOW_PRIORITY] = 1;
+                ctx.options[SHOW_PRIORITY] = 1;
                 break;
             case 'z':
-                options[SHOW_SIZE] = 1;
+                ctx.options[SHOW_SIZE] = 1;
                 break;
             case 'H':
-                options[FORCE_HOLD] = 1;
+                ctx.options[FORCE_HOLD] = 1;
                 break;
             case 'k':
                 kfile = optarg;
                 break;
             case 'A':
-                options[ADD_KEEP] = 1;
+                ctx.options[ADD_KEEP] = 1;
                 break;
             case 'R':
-                options[DEL_KEEP] = 1;
+                ctx.options[DEL_KEEP] = 1;
                 break;
             case 'L':
-                options[LIST_KEEP] = 1;
+                ctx.options[LIST_KEEP] = 1;
                 break;
             case 'Z':
-                options[ZERO_KEEP] = 1;
+                ctx.options[ZERO_KEEP] = 1;
                 break;
             case 1:
-                guess_set(GUESS_DEV);
+                guess_set(&ctx, GUESS_DEV);
                 break;
             case 31:
-                guess_clr(GUESS_DEV);
+                guess_clr(&ctx, GUESS_DEV);
                 break;
             case 2:
-                guess_set(GUESS_PERL);
+                guess_set(&ctx, GUESS_PERL);
                 break;
             case 32:
-                guess_clr(GUESS_PERL);
+                guess_clr(&ctx, GUESS_PERL);
                 break;
             case 3:
-                guess_set(GUESS_SECTION);
+                guess_set(&ctx, GUESS_SECTION);
                 break;
             case 33:
-                guess_clr(GUESS_SECTION);
+                guess_clr(&ctx, GUESS_SECTION);
                 break;
             case 4:
-                guess_set(GUESS_ALL);
+                guess_set(&ctx, GUESS_ALL);
                 break;
             case 34:
-                guess_clr(GUESS_ALL);
+                guess_clr(&ctx, GUESS_ALL);
                 break;
             case 5:
-                guess_set(GUESS_DEBUG);
+                guess_set(&ctx, GUESS_DEBUG);
                 break;
             case 35:
-                guess_clr(GUESS_DEBUG);
+                guess_clr(&ctx, GUESS_DEBUG);
                 break;
 #ifdef DEBFOSTER_KEEP
             case 6:
-                options[NO_DEBFOSTER] = 0;
+                ctx.options[NO_DEBFOSTER] = 0;
                 break;
 #endif
             case 7:
-                options[GUESS_ONLY] = 1;
+                ctx.options[GUESS_ONLY] = 1;
                 break;
 #ifdef DEBFOSTER_KEEP
             case 8:
-                options[NO_DEBFOSTER] = 1;
+                ctx.options[NO_DEBFOSTER] = 1;
                 break;
 #endif
             case 9:
-                guess_set(GUESS_PIKE);
+                guess_set(&ctx, GUESS_PIKE);
                 break;
             case 39:
-                guess_clr(GUESS_PIKE);
+                guess_clr(&ctx, GUESS_PIKE);
                 break;
             case 10:
-                guess_set(GUESS_PYTHON);
+                guess_set(&ctx, GUESS_PYTHON);
                 break;
             case 40:
-                guess_clr(GUESS_PYTHON);
+                guess_clr(&ctx, GUESS_PYTHON);
                 break;
             case 11:
-                guess_set(GUESS_RUBY);
+                guess_set(&ctx, GUESS_RUBY);
                 break;
             case 41:
-                guess_clr(GUESS_RUBY);
+                guess_clr(&ctx, GUESS_RUBY);
                 break;
             case 12:
-                guess_set(GUESS_IP);
+                guess_set(&ctx, GUESS_IP);
                 break;
             case 42:
-                guess_clr(GUESS_IP);
+                guess_clr(&ctx, GUESS_IP);
                 break;
             case 13:
-                guess_set(GUESS_DUMMY);
+                guess_set(&ctx, GUESS_DUMMY);
                 break;
             case 43:
-                guess_clr(GUESS_DUMMY);
+                guess_clr(&ctx, GUESS_DUMMY);
                 break;
             case 14:
-                guess_set(GUESS_COMMON);
+                guess_set(&ctx, GUESS_COMMON);
                 break;
             case 44:
-                guess_clr(GUESS_COMMON);
+                guess_clr(&ctx, GUESS_COMMON);
                 break;
             case 15:
-                guess_set(GUESS_DATA);
+                guess_set(&ctx, GUESS_DATA);
                 break;
             case 45:
-                guess_clr(GUESS_DATA);
+                guess_clr(&ctx, GUESS_DATA);
                 break;
             case 16:
-                guess_set(GUESS_DOC);
+                guess_set(&ctx, GUESS_DOC);
                 break;
             case 46:
-                guess_clr(GUESS_DOC);
+                guess_clr(&ctx, GUESS_DOC);
                 break;
             case 17:
-                options[FIND_CONFIG] = 1;
-                options[ALL_PACKAGES] = 1;
+                ctx.options[FIND_CONFIG] = 1;
+                ctx.options[ALL_PACKAGES] = 1;
                 break;
             case 18:
-                options[SEARCH_LIBDEVEL] = 1;
+                ctx.options[SEARCH_LIBDEVEL] = 1;
                 break;
             case 19:
-                guess_set(GUESS_MONO);
+                guess_set(&ctx, GUESS_MONO);
                 break;
             case 49:
-                guess_clr(GUESS_MONO);
+                guess_clr(&ctx, GUESS_MONO);
                 break;
             case 20:
-                guess_set(GUESS_KERNEL);
+                guess_set(&ctx, GUESS_KERNEL);
                 break;
             case 50:
-                guess_clr(GUESS_KERNEL);
+                guess_clr(&ctx, GUESS_KERNEL);
                 break;
             case 21:
-                guess_set(GUESS_JAVA);
+                guess_set(&ctx, GUESS_JAVA);
                 break;
             case 51:
-                guess_clr(GUESS_JAVA);
+                guess_clr(&ctx, GUESS_JAVA);
                 break;
             case 'e':
-                while (optarg) {
-                    char* c_ptr;
-                    if (exclude_list_cnt >= exclude_list_max) {
-                        /* grow exclude_list[] array */
-                        exclude_list_max = exclude_list_max
-                                               ? exclude_list_max * 2
-                                               : INIT_EXCLUDES_COUNT;
-#ifdef DEBUG
-                        fprintf(stderr, "Growing excludes field to %d.\n",
-                                exclude_list_max);
-                        fflush(stderr);
-#endif /* DEBUG */
-                        exclude_list =
-                            realloc(exclude_list,
-                                    exclude_list_max * sizeof(exclude_list[0]));
-                    }
-                    if (exclude_list_cnt >= exclude_list_max)
-                        error(EXIT_FAILURE, 0, "Too many exclude packages");
-                    c_ptr = strsep(&optarg, ",");
-                    c_ptr[strcspn(c_ptr, ":")] =
-                        '\0'; /* remove architecture suffix */
-                    exclude_list[exclude_list_cnt].name = c_ptr;
-                    exclude_list[exclude_list_cnt].namehash = strhash(c_ptr);
-                    ++exclude_list_cnt;
-                }
-                qsort(exclude_list, exclude_list_cnt, sizeof(exclude_list[0]),
-                      (int (*)(const void*, const void*))depcmp);
+                while (optarg)
+                    if (add_exclude(&ctx, strsep(&optarg, ",")) < 0)
+                        error(EXIT_FAILURE, errno, "exclude");
                 break;
             case '?':
-                if (options[CHECK_OPTIONS])
+                if (ctx.options[CHECK_OPTIONS])
                     exit(EXIT_FAILURE);
                 print_usage(stderr);
                 exit(EXIT_FAILURE);
         }
     }
 
-    if (options[CHECK_OPTIONS])
+    if (ctx.options[CHECK_OPTIONS])
         exit(EXIT_SUCCESS);
 
-    if (options[ZERO_KEEP]) {
+    if (ctx.options[LOW_IMPACT])
+        lower_impact(&ctx);
+
+    if (ctx.options[PURGE_LIST] && !ctx.options[FIND_CONFIG])
+        error(EXIT_FAILURE, 0, "--purge-list needs --find-config.");
+    check_exclusive(
+        (sfile ? GIVEN_STATUS_FILE : 0) | (kfile ? GIVEN_KEEP_FILE : 0) |
+        (efile ? GIVEN_EXTENDED_STATES : 0) |
+        (ctx.options[ROOTS] ? GIVEN_ROOT : 0) |
+        (ctx.options[FLEET] ? GIVEN_FLEET : 0) |
+        (ctx.options[DIFF] ? GIVEN_DIFF : 0) |
+        (cfile ? GIVEN_CACHE_FILE : 0) | (sockpath ? GIVEN_SERVE : 0) |
+        (ctx.options[WATCH] ? GIVEN_WATCH : 0) |
+        (ctx.options[SHOW_DEPS] ? GIVEN_SHOW_DEPS : 0) |
+        (ctx.options[AUTO_ONLY] ? GIVEN_AUTO_ONLY : 0) |
+        (ctx.options[LOW_MEMORY] ? GIVEN_LOW_MEMORY : 0) |
+        (ctx.options[PURGE_LIST] ? GIVEN_PURGE_LIST : 0) |
+        (ctx.options[EXPLAIN_FILTER] ? GIVEN_EXPLAIN_FILTER : 0) |
+        (ctx.options[FORMAT] != FORMAT_TEXT ? GIVEN_FORMAT : 0) |
+        (ctx.options[ADD_KEEP] || ctx.options[DEL_KEEP] ||
+                 ctx.options[LIST_KEEP] || ctx.options[ZERO_KEEP]
+             ? GIVEN_KEEP_MGMT
+             : 0) |
+        (optind < argc ? GIVEN_PACKAGES : 0) |
+        /* Only where packages are listed, not for --diff and the like. */
+        (ctx.options[FORMAT] == FORMAT_NUL && !ctx.options[DIFF] &&
+                 !ctx.options[EXPLAIN_FILTER] && !ctx.options[ADD_KEEP] &&
+                 !ctx.options[DEL_KEEP]
+             ? GIVEN_NUL
+             : 0));
+
+    if (ctx.options[DIFF] && argc - optind != 2) {
+        print_usage(stderr);
+        error(EXIT_FAILURE, 0, "--diff needs an old and a new status file.");
+    }
+
+    if (ctx.options[FLEET]) {
+        /* This host's keep file has nothing to do with the fleet, only
+         * one given with -k is used. */
+        if ((i = run_fleet(&ctx, fleetdir, kfile)) < 0)
+            error(EXIT_FAILURE, errno, "%s", fleetdir);
+        context_free(&ctx);
+        return i ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    if (ctx.options[ZERO_KEEP]) {
         if (!kfile)
             kfile = KEEPER_FILE;
         if (zerofile(kfile) < 0)
             error(EXIT_FAILURE, errno, "%s", kfile);
 
         /* Don't always exit. "deborphan -Z -A <foo>" should be valid. */
-        if (!options[ADD_KEEP])
+        if (!ctx.options[ADD_KEEP])
             exit(EXIT_SUCCESS);
     }
 
-    if (options[LIST_KEEP]) {
+    if (ctx.options[LIST_KEEP]) {
         if (!kfile)
             kfile = KEEPER_FILE;
 
@@ -412,7 +627,7 @@ int main(int argc, char* argv[]) {
 #endif
         }
 #ifdef DEBFOSTER_KEEP
-        if (!options[NO_DEBFOSTER]) {
+        if (!ctx.options[NO_DEBFOSTER]) {
             fprintf(stderr, "-- %s -- \n", DEBFOSTER_KEEP);
             listkeep(DEBFOSTER_KEEP);
         }
@@ -420,7 +635,7 @@ int main(int argc, char* argv[]) {
         exit(EXIT_SUCCESS);
     }
 
-    if (options[GUESS_ONLY] && !options[GUESS]) {
+    if (ctx.options[GUESS_ONLY] && !ctx.options[GUESS]) {
         print_usage(stderr);
         error(EXIT_FAILURE, 0, "need at least one other --guess option.");
     }
@@ -431,49 +646,61 @@ int main(int argc, char* argv[]) {
         kfile = KEEPER_FILE;
     if (sfile == NULL)
         sfile = STATUS_FILE;
-
-    if ((argc - argind) > 50)
-        error(EXIT_FAILURE, E2BIG, "");
-
-    if (argind < argc) {
-        options[SEARCH] = 1;
-        options[ALL_PACKAGES] = 1;
-        options[SHOW_DEPS] = 1;
-        options[PRIORITY] = 0;
+    if (efile == NULL)
+        efile = EXTENDED_STATES_FILE;
+
+    /* With --explain-filter, the packages given are only the ones to
+     * explain, the filter stays as it is. */
+    if (argind < argc && !ctx.options[DIFF] &&
+        !ctx.options[EXPLAIN_FILTER]) {
+        ctx.options[SEARCH] = 1;
+        ctx.options[ALL_PACKAGES] = 1;
+        ctx.options[SHOW_DEPS] = 1;
+        ctx.options[PRIORITY] = 0;
     }
 
-    if (options[SHOW_DEPS])
-        options[FORCE_HOLD] = 1;
+    if (ctx.options[SHOW_DEPS])
+        ctx.options[FORCE_HOLD] = 1;
 
-    keep = readkeep(kfile);
+    if (ctx.options[ROOTS])
+        return run_roots(&ctx, roots, roots_cnt) ? EXIT_FAILURE
+                                                 : EXIT_SUCCESS;
 
-    if (options[ADD_KEEP] || options[DEL_KEEP]) {
+    if (ctx.options[ADD_KEEP] || ctx.options[DEL_KEEP]) {
         char** args;
+
+        keep_init(&ctx.keep);
+        readkeep(&ctx.keep, kfile);
         if (argind >= argc)
             error(EXIT_FAILURE, 0, "not enough arguments for %s.",
-                  options[ADD_KEEP] ? "--add-keep" : "--del-keep");
+                  ctx.options[ADD_KEEP] ? "--add-keep" : "--del-keep");
 
         args = parseargs(argind, argc, argv);
 
         for (j = 0; args[j] != NULL; j++)
             args[j][strcspn(args[j], ":")] = '\0'; /* remove arch suffix */
 
-        if (options[DEL_KEEP]) {
-            switch (delkeep(kfile, args)) {
-                case -1:
-                    error(EXIT_FAILURE, errno, "%s", kfile);
-                    break; /* make splint happy */
-                case 1:
-                    error(EXIT_FAILURE, 0, "no packages removed.");
-            }
+        if (ctx.options[DEL_KEEP]) {
+            /* Names that are not in the keep file are no error. */
+            if (delkeep(kfile, args) < 0)
+                error(EXIT_FAILURE, errno, "%s", kfile);
         } else {
-            i = pkggrep(sfile, args);
+            int* found = calloc(j ? j : 1, sizeof(int));
+
+            if (!found)
+                error(EXIT_FAILURE, errno, "add-keep");
+            i = pkggrep(sfile, args, found);
             if (i < 0)
-                error(EXIT_FAILURE, errno, sfile);
+                error(EXIT_FAILURE, errno, "%s", sfile);
+            for (j = 0; args[j]; j++)
+                if (!found[j])
+                    fprintf(stderr, "%s: %s: no such package.\n",
+                            program_name, args[j]);
+            free(found);
             if (i)
-                error(EXIT_FAILURE, 0, "%s: no such package.", args[i - 1]);
+                exit(EXIT_FAILURE);
 
-            if ((i = hasduplicate(args)))
+            if ((i = hasduplicate(&ctx.keep, args)))
                 error(EXIT_FAILURE, 0, "%s: duplicate entry.", args[i - 1]);
 
             if (addkeep(kfile, args) < 0)
@@ -486,81 +713,94 @@ int main(int argc, char* argv[]) {
     /* We don't want to merge the files if we're adding, because it's perfectly
        alright to have the same entry in debfoster and deborphan.
     */
-#ifdef DEBFOSTER_KEEP
-    if (!options[NO_DEBFOSTER]) {
-        dep* dfkeep = readkeep(DEBFOSTER_KEEP);
-
-        if (dfkeep) {
-            dep* d = keep;
-            keep = mergekeep(keep, dfkeep);
-            free(d);
-            free(dfkeep);
-        }
-    }
-#endif
+    readkeep_all(&ctx.keep, kfile, ctx.options[NO_DEBFOSTER]);
 
-    search_for = parseargs_as_dep(argind, argc, argv);
+    if (ctx.options[AUTO_ONLY] && read_extended_states(&ctx, efile) < 0)
+        error(EXIT_FAILURE, errno, "%s", efile);
 
-    if (!(sfile_content = debopen(sfile)))
-        error(EXIT_FAILURE, errno, "%s", sfile);
+    if (ctx.options[DIFF]) {
+        init_pkg_regex(&ctx);
+        run_diff(&ctx, argv[argind], argv[argind + 1]);
+        context_free(&ctx);
+        return EXIT_SUCCESS;
+    }
 
-    sfile_content2 = sfile_content;
+    /* Packages in the config-files state are reported whatever depends
+     * on them, so only --show-deps needs their dependencies. */
+    if (ctx.options[FIND_CONFIG] && !ctx.options[SHOW_DEPS] && !cfile &&
+        !sockpath && !ctx.options[WATCH] && !ctx.options[EXPLAIN_FILTER]) {
+        init_pkg_regex(&ctx);
+        if (run_find_config(&ctx, sfile) < 0)
+            error(EXIT_FAILURE, errno, "%s", sfile);
+        context_free(&ctx);
+        return EXIT_SUCCESS;
+    }
 
-    this = package = (pkg_info*)malloc(sizeof(pkg_info));
-    init_pkg(this);
-    init_pkg_regex();
+    /* Past the memory ceiling, the status file is gone through twice
+     * rather than read into a list, when nothing else needs the list. */
+    if (ceiling && !cfile && !sockpath && !ctx.options[WATCH] &&
+        !ctx.options[SHOW_DEPS] && !ctx.options[EXPLAIN_FILTER] &&
+        exceeds_ceiling(sfile, ceiling))
+        ctx.options[LOW_MEMORY] = 1;
+
+    if (ctx.options[LOW_MEMORY]) {
+        init_pkg_regex(&ctx);
+        if (run_lowmem(&ctx, sfile) < 0)
+            error(EXIT_FAILURE, errno, "%s", sfile);
+        context_free(&ctx);
+        return EXIT_SUCCESS;
+    }
 
-    while ((line = strsep(&sfile_content, "\n")) != NULL) {
-        if ((!strchr("AIPpSsEeDdRr", *line)) || (*line == ' '))
-            continue;
+    search_init(&ctx.search_for, parseargs_as_dep(argind, argc, argv));
 
-        if (*line != '\0') {
-            strstripchr(line, ' ');
-            get_pkg_info(line, this, &multiarch);
-            continue;
-        }
-        if (!this->install && !options[FIND_CONFIG]) {
-            reinit_pkg(this);
-            continue;
-        }
-        if (this->self.name && exclude_list &&
-            bsearch(&this->self, exclude_list, exclude_list_cnt,
-                    sizeof(exclude_list[0]),
-                    (int (*)(const void*, const void*))depcmp)) {
-            reinit_pkg(this);
-            continue;
-        }
-        this->next = malloc(sizeof(pkg_info));
-        this = this->next;
-        init_pkg(this);
+    if (ctx.options[WATCH] || sockpath) {
+        init_pkg_regex(&ctx);
+        if (sockpath)
+            run_serve(&ctx, sockpath, sfile, kfile, cfile);
+        run_watch(&ctx, sfile, cfile);
     }
 
-    free(sfile_content2);
-
-    this->next = NULL;
-    this = package;
+    init_pkg_regex(&ctx);
+
+    /* Without --show-deps only the verdicts are needed, and those can be
+     * carried over from the last run. */
+    if (cfile && !ctx.options[SHOW_DEPS]) {
+        if (!(sfile_content = debopen_status(sfile)))
+            error(EXIT_FAILURE, errno, "%s", sfile);
+        forget_file(&ctx, sfile);
+        i = run_incremental(&ctx, sfile_content, cfile);
+        free(sfile_content);
+        context_free(&ctx);
+        return i ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
 
-    print_arch_suffixes = (options[SHOW_ARCH] == ALWAYS ||
-                           (options[SHOW_ARCH] == DEFAULT && multiarch));
+    if (!(package = read_status_file(&ctx, sfile, &multiarch)))
+        error(EXIT_FAILURE, errno, "%s", sfile);
+    if (ctx.bad_status)
+        exit_bad_status(ctx.bad_status);
+    if (ctx.search_for.cnt)
+        search_expand(&ctx.search_for, package);
 
-    /* Check the dependencies. Last package is handled specially, because it
-       is not terminated with a \n in STATUS_FILE. */
-    while (this->next) {
-        check_lib_deps(package, this, print_arch_suffixes);
-        this = this->next;
-    }
-    if (this->install)
-        check_lib_deps(package, this, print_arch_suffixes);
+    print_arch_suffixes = (ctx.options[SHOW_ARCH] == ALWAYS ||
+                           (ctx.options[SHOW_ARCH] == DEFAULT && multiarch));
 
-    free_pkg_regex();
+    /* Check the dependencies. */
+    if (ctx.options[EXPLAIN_FILTER])
+        explain_filter(&ctx, package, print_arch_suffixes);
+    else
+        check_orphans(&ctx, package, print_arch_suffixes);
 
-    fflush(stdout);
+    print_done(&ctx);
 
-    for (i = 0; options[SEARCH] && search_for[i].name; i++) {
-        fprintf(stderr, "%s: package %s", argv[0], search_for[i].name);
-        if (search_for[i].arch)
-            fprintf(stderr, ":%s", search_for[i].arch);
+    for (i = 0, j = 0; j < ctx.search_for.given; j++) {
+        if (ctx.search_for.found[j])
+            continue;
+        fprintf(stderr, "%s: package %s", argv[0],
+                ctx.search_for.pkgs[j].name);
+        if (ctx.search_for.pkgs[j].arch)
+            fprintf(stderr, ":%s", ctx.search_for.pkgs[j].arch);
         fprintf(stderr, " not found or not installed\n");
+        i++;
     }
 
     return i ? EXIT_FAILURE : EXIT_SUCCESS;
@@ -0,0 +1,75 @@
+/* diff.c - Comparing the orphans of two status files for deborphan.
+
+   Distributed under the terms of the MIT License, see the
+   file COPYING provided in this package for details.
+*/
+
+/* --diff OLD NEW runs both status files through the same snapshot, as
+ * --watch does with the versions of one status file: NEW is hashed
+ * stanza by stanza, and only the stanzas that are not in OLD are parsed,
+ * and only the packages whose dependents changed are checked again.
+ * The names and reverse dependency counts of OLD are reused as they are.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cache.h>
+
+#include "config.h"
+#include "deborphan.h"
+
+static int load(snapshot* s, const char* sfile) {
+    char* content;
+
+    if (!(content = debopen_status(sfile)))
+        return -1;
+    if (snapshot_update(s, content) < 0) {
+        if (errno == EBADMSG)
+            exit_bad_status(s->ctx->bad_status);
+        error(EXIT_FAILURE, errno, "%s", sfile);
+    }
+    free(content);
+    forget_file(s->ctx, sfile);
+
+    return 0;
+}
+
+/* Print the packages that are orphans in newfile but not in oldfile,
+ * prefixed by `+', and those that are no longer, prefixed by `-'.
+ */
+void run_diff(context* ctx, const char* oldfile, const char* newfile) {
+    orphan_set before, after;
+    snapshot s;
+    int print_suffix, multiarch;
+
+    snapshot_init(&s, ctx);
+
+    if (load(&s, oldfile) < 0)
+        error(EXIT_FAILURE, errno, "%s", oldfile);
+    multiarch = s.multiarch;
+    collect_orphans(&s, &before);
+
+    if (load(&s, newfile) < 0)
+        error(EXIT_FAILURE, errno, "%s", newfile);
+    multiarch |= s.multiarch;
+    collect_orphans(&s, &after);
+
+#ifdef DEBUG
+    fprintf(stderr, "Reparsed %d stanzas, rechecked %d packages.\n",
+            s.reparsed, s.rechecked);
+#endif /* DEBUG */
+
+    print_suffix = (ctx->options[SHOW_ARCH] == ALWAYS ||
+                    (ctx->options[SHOW_ARCH] == DEFAULT && multiarch));
+    print_header(ctx);
+    print_missing(ctx, &before, &after, '-', print_suffix);
+    print_missing(ctx, &after, &before, '+', print_suffix);
+    print_done(ctx);
+
+    free_orphans(&before);
+    free_orphans(&after);
+    snapshot_free(&s);
+}
@@ -20,6 +20,9 @@
 #include <libintl.h>
 #endif
 
+/* Name this program was called with. */
+char* program_name = PACKAGE;
+
 /* Print an error message stating the program name, an optional,
    user defined string and an error message as produced by strerror(error_no).
    If exit_status is non-nil, the program will terminate. */
@@ -56,7 +59,32 @@ void exit_help(void) {
     printf(_("-h        This help.\n"));
 
     printf("--status-file,    ");
-    printf(_("-f FILE   Use FILE as statusfile.\n"));
+    printf(_("-f FILE   Use FILE as statusfile, - for standard input.\n"));
+
+    printf(_("--cache-file FILE           Only re-analyse what changed since "
+             "the last run.\n"));
+    printf(_("--verify-cache              Compare the cached result to a full "
+             "run.\n"));
+    printf(_("--watch                     Print changes to the orphans whenever "
+             "dpkg runs.\n"));
+    printf(_("--serve SOCKET              Answer queries on the Unix socket "
+             "SOCKET.\n"));
+
+    printf("--jobs,           ");
+    printf(_("-j N      Parse and check packages in N threads.\n"));
+    printf(_("--low-memory                Find orphans without keeping the "
+             "packages in memory.\n"));
+    printf(_("--low-impact[=SIZE]         Run at idle priority, and in SIZE "
+             "bytes of memory.\n"));
+    printf(_("--root DIR                  Analyse the system installed below "
+             "DIR.\n"));
+    printf(_("--roots-from FILE           Read the roots to analyse from "
+             "FILE.\n"));
+    printf(_("--fleet DIR                 Count the orphans of the status "
+             "files in DIR.\n"));
+    printf(_("--diff OLD NEW              Show how the orphans of the status "
+             "file NEW\n"
+             "                            differ from those of OLD.\n"));
 
     printf("--version,        ");
     printf(_("-v        Version information.\n"));
@@ -76,6 +104,10 @@ void exit_help(void) {
     printf("--show-size,      ");
     printf(_("-z        Show installed size of packages found.\n"));
 
+    printf(_("--format FMT                Output text, jsonl, tsv or nul.\n"));
+    printf("                  ");
+    printf(_("-0        Same as --format=nul.\n"));
+
     /* search modifiers */
     printf("--all-packages,   ");
     printf(_("-a        Compare all packages, not just libs.\n"));
@@ -103,10 +135,18 @@ void exit_help(void) {
     printf(
         _("--find-config               Find \"orphaned\" configuration "
           "files.\n"));
+    printf(_("--purge-list                Print them on one line, for dpkg "
+             "--purge.\n"));
 
+    printf(_("--explain-filter            Show why packages are not checked "
+             "for dependents.\n"));
     printf(_(
         "--libdevel                  Also search in section \"libdevel\".\n"));
 
+    printf(_("--auto-only                 Only report packages APT installed "
+             "automatically.\n"));
+    printf(_("--extended-states FILE      Read APT's marks from FILE.\n"));
+
     /* keep file management */
     printf("--add-keep,       ");
     printf(_("-A PKGS.. Never report PKGS.\n"));
@@ -213,3 +253,16 @@ Note: dpkg --audit may be used to find such packages.\n"));
 void exit_invalid_statusfile(void) {
     error(EXIT_FAILURE, 0, _("Status file is probably invalid. Exiting.\n"));
 }
+
+void exit_bad_status(int bad_status) {
+    if (bad_status == STATUS_IMPROPER)
+        exit_improperstate();
+    exit_invalid_statusfile();
+}
+
+/* The same in short, for modes that go on without the status file. */
+const char* bad_status_message(int bad_status) {
+    if (bad_status == STATUS_IMPROPER)
+        return _("status file is in an improper state");
+    return _("status file is probably invalid");
+}
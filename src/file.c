@@ -7,11 +7,15 @@
    file COPYING provided in this package for details.
 */
 
+#include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <hash.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -19,6 +23,13 @@
 #include "config.h"
 #include "deborphan.h"
 
+static int is_compressed_fd(int fd) {
+    char magic[8];
+    ssize_t n = pread(fd, magic, sizeof(magic), 0);
+
+    return n > 0 && is_compressed(magic, n);
+}
+
 /* This uses up as much memory as your status file (near a
  * megabyte). It is considerably faster, though.
  */
@@ -36,6 +47,12 @@ char* debopen(const char* filename) {
         return NULL;
     }
 
+    if (!S_ISREG(statbuf.st_mode) || is_compressed_fd(fd)) {
+        buf = debread(fd, filename);
+        close(fd);
+        return buf;
+    }
+
     buf = (char*)malloc((size_t)(statbuf.st_size + 1));
 
     if (read(fd, buf, (size_t)statbuf.st_size) < statbuf.st_size) {
@@ -50,6 +67,281 @@ char* debopen(const char* filename) {
     return buf;
 }
 
+/* Map filename read-only and set *len to its size. Unlike debopen(),
+ * this takes no memory of the process's own: the pages are the kernel's
+ * cache of the file and can be dropped and read again under pressure.
+ * The contents are not '\0' terminated. Returns NULL on failure, and
+ * for anything but a regular, uncompressed file.
+ */
+char* debmap(const char* filename, size_t* len) {
+    static char empty[1];
+    struct stat statbuf;
+    char* buf;
+    int fd;
+
+    /* Not even opened if it is a pipe: its writer would see it closed. */
+    if (stat(filename, &statbuf) < 0)
+        return NULL;
+    if (!S_ISREG(statbuf.st_mode)) {
+        errno = ENODEV;
+        return NULL;
+    }
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &statbuf) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    /* An empty file can't be mapped, but it is a valid status file. */
+    *len = statbuf.st_size;
+    if (!*len) {
+        close(fd);
+        return empty;
+    }
+
+    buf = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED)
+        return NULL;
+    if (is_compressed(buf, *len)) {
+        munmap(buf, *len);
+        errno = ENODEV;
+        return NULL;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(buf, *len, MADV_SEQUENTIAL);
+#endif
+
+    return buf;
+}
+
+void debunmap(char* buf, size_t len) {
+    if (len)
+        munmap(buf, len);
+}
+
+/* Where dpkg keeps the entries it has not yet folded into sfile. */
+char* status_updates_dir(const char* sfile) {
+    const char* slash = strrchr(sfile, '/');
+    size_t dirlen = slash ? (size_t)(slash - sfile + 1) : 0;
+    char* dir = malloc(dirlen + sizeof("updates"));
+
+    memcpy(dir, sfile, dirlen);
+    strcpy(dir + dirlen, "updates");
+
+    return dir;
+}
+
+/* dpkg names its journal entries with nothing but digits; anything else
+ * in there (tmp.i, for one) is not committed yet.
+ */
+int is_journal_name(const char* name) {
+    if (!*name)
+        return 0;
+    for (; *name; name++)
+        if (!isdigit((unsigned char)*name))
+            return 0;
+    return 1;
+}
+
+static int journal_filter(const struct dirent* ent) {
+    return is_journal_name(ent->d_name);
+}
+
+static int journal_cmp(const struct dirent** a, const struct dirent** b) {
+    unsigned long x = strtoul((*a)->d_name, NULL, 10);
+    unsigned long y = strtoul((*b)->d_name, NULL, 10);
+
+    return (x > y) - (x < y);
+}
+
+/* Returns 1 if dpkg has journal entries for sfile it has not folded into
+ * it yet, i.e. if debopen_status() would not return sfile as it is.
+ */
+int status_has_updates(const char* sfile) {
+    struct dirent** ents;
+    char* dir;
+    int i, nents;
+
+    if (strcmp(sfile, "-") == 0)
+        return 0;
+    dir = status_updates_dir(sfile);
+    nents = scandir(dir, &ents, journal_filter, NULL);
+    free(dir);
+    if (nents < 0)
+        return 0;
+    for (i = 0; i < nents; i++)
+        free(ents[i]);
+    free(ents);
+
+    return nents > 0;
+}
+
+typedef struct journal_entry {
+    char* key; /* "name:arch" */
+    char* text;
+    size_t len;
+    int used;
+    struct journal_entry* next;
+} journal_entry;
+
+static int journal_eq(const void* value, const void* key) {
+    return strcmp(((const journal_entry*)value)->key, (const char*)key) == 0;
+}
+
+/* Copy the value of field out of a stanza, stopping at the end of the
+ * line. Returns the number of characters written.
+ */
+static size_t stanza_field(const char* stanza,
+                           const char* field,
+                           char* dst,
+                           size_t max) {
+    size_t flen = strlen(field), n = 0;
+    const char* line;
+
+    for (line = stanza; line; line = strchr(line, '\n')) {
+        if (*line == '\n')
+            line++;
+        if (strncmp(line, field, flen) == 0) {
+            line += flen;
+            while (*line == ' ')
+                line++;
+            while (n < max && line[n] && line[n] != '\n' && line[n] != ' ')
+                n++;
+            memcpy(dst, line, n);
+            break;
+        }
+    }
+
+    return n;
+}
+
+static void stanza_key(const char* stanza, char* key, size_t max) {
+    size_t n;
+
+    n = stanza_field(stanza, "Package:", key, max - 2);
+    key[n++] = ':';
+    n += stanza_field(stanza, "Architecture:", key + n, max - n - 1);
+    key[n] = '\0';
+}
+
+static void append_stanza(char* buf,
+                          size_t* len,
+                          const char* s,
+                          size_t slen) {
+    memcpy(buf + *len, s, slen);
+    *len += slen;
+    memcpy(buf + *len, "\n\n", 2);
+    *len += 2;
+}
+
+/* Read sfile and lay dpkg's journal (updates/NNNN next to it) over it,
+ * the way dpkg itself does before it rewrites the status file: an entry
+ * in the journal replaces the stanza of the same package and
+ * architecture, later entries win, and packages the status file doesn't
+ * know yet are appended. Without a journal this is just debopen(). A
+ * status file "-" is read from standard input, and has no journal.
+ */
+char* debopen_status(const char* sfile) {
+    struct dirent** ents;
+    journal_entry *entries = NULL, **tail = &entries, *e;
+    char **files, *content, *dir, *buf, *p, *stanza;
+    char key[512];
+    size_t len, total;
+    hashtable idx;
+    int i, nents;
+
+    if (strcmp(sfile, "-") == 0)
+        return debread(STDIN_FILENO, sfile);
+    if (!(content = debopen(sfile)))
+        return NULL;
+
+    dir = status_updates_dir(sfile);
+    nents = scandir(dir, &ents, journal_filter, journal_cmp);
+    if (nents <= 0) {
+        free(dir);
+        if (nents == 0)
+            free(ents);
+        return content;
+    }
+
+    files = malloc(nents * sizeof(char*));
+    hash_init(&idx, nents);
+    total = strlen(content) + 2;
+
+    for (i = 0; i < nents; i++) {
+        char* path = malloc(strlen(dir) + strlen(ents[i]->d_name) + 2);
+
+        sprintf(path, "%s/%s", dir, ents[i]->d_name);
+        files[i] = debopen(path);
+        free(path);
+        free(ents[i]);
+
+        /* dpkg may have folded it in and removed it meanwhile. */
+        if (!(p = files[i]))
+            continue;
+
+        while ((stanza = next_stanza(&p, &len)) != NULL) {
+            if (!len)
+                continue;
+            stanza_key(stanza, key, sizeof(key));
+
+            e = hash_find(&idx, memhash(key, strlen(key)), journal_eq, key);
+            if (!e) {
+                e = malloc(sizeof(journal_entry));
+                e->key = strdup(key);
+                e->used = 0;
+                e->next = NULL;
+                *tail = e;
+                tail = &e->next;
+                hash_add(&idx, memhash(key, strlen(key)), e);
+            }
+            e->text = stanza;
+            e->len = len;
+            total += len + 2;
+        }
+    }
+    free(ents);
+    free(dir);
+
+    buf = malloc(total + 1);
+    total = 0;
+    p = content;
+    while ((stanza = next_stanza(&p, &len)) != NULL) {
+        if (!len)
+            continue;
+        stanza_key(stanza, key, sizeof(key));
+        e = hash_find(&idx, memhash(key, strlen(key)), journal_eq, key);
+        if (!e) {
+            append_stanza(buf, &total, stanza, len);
+        } else if (!e->used) {
+            append_stanza(buf, &total, e->text, e->len);
+            e->used = 1;
+        }
+    }
+
+    while ((e = entries) != NULL) {
+        if (!e->used)
+            append_stanza(buf, &total, e->text, e->len);
+        entries = e->next;
+        free(e->key);
+        free(e);
+    }
+    buf[total] = '\0';
+
+    for (i = 0; i < nents; i++)
+        free(files[i]);
+    free(files);
+    hash_free(&idx);
+    free(content);
+
+    return buf;
+}
+
 int zerofile(const char* filename) {
     int fd = open(filename, O_WRONLY | O_TRUNC);
     if (fd < 0) {
@@ -0,0 +1,301 @@
+/* fleet.c - Counting orphans across many hosts for deborphan.
+
+   Distributed under the terms of the MIT License, see the
+   file COPYING provided in this package for details.
+*/
+
+/* With --fleet, every file in a directory is the status file of one
+ * host, and what is printed is, for every package that is an orphan on
+ * any host, on how many hosts it is one and how much space it takes on
+ * all of them together.
+ *
+ * Nothing is kept per host. The hosts are run through the snapshot of
+ * --cache-file, one after the other: a stanza that is the same as on the
+ * host before is neither parsed nor checked again, which for a fleet of
+ * similar hosts is most of them. The orphans of a host are then added
+ * to counters indexed by name, so memory grows with the number of
+ * distinct names and not with the number of hosts. With -j, each thread
+ * has a snapshot and counters of its own, and the counters are added up
+ * at the end.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <cache.h>
+
+#include "config.h"
+#include "deborphan.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+typedef struct fleet_count {
+    char* name;
+    int hosts;
+    long size;
+    int last_host; /* the host counted last, a host counts once */
+} fleet_count;
+
+typedef struct fleet_worker {
+    context ctx;
+    snapshot snap;
+    hashtable counts; /* name -> fleet_count */
+} fleet_worker;
+
+typedef struct fleet_job {
+    const char* dir;
+    struct dirent** hosts;
+    int hosts_cnt;
+    int next;
+    int failed;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t lock;
+#endif
+} fleet_job;
+
+static int count_eq(const void* value, const void* key) {
+    return strcmp(((const fleet_count*)value)->name, (const char*)key) == 0;
+}
+
+static fleet_count* count_get(hashtable* t, const char* name) {
+    unsigned long long h = memhash(name, strlen(name));
+    fleet_count* c = hash_find(t, h, count_eq, name);
+
+    if (!c) {
+        if (!(c = calloc(1, sizeof(fleet_count))) ||
+            !(c->name = strdup(name)))
+            error(EXIT_FAILURE, errno, "fleet");
+        c->last_host = -1;
+        hash_add(t, h, c);
+    }
+
+    return c;
+}
+
+static void counts_free(hashtable* t) {
+    size_t i;
+
+    for (i = 0; t->slots && i <= t->mask; i++) {
+        fleet_count* c = t->slots[i].value;
+        if (c) {
+            free(c->name);
+            free(c);
+        }
+    }
+    hash_free(t);
+}
+
+/* Dot files, e.g. those of an rsync in progress, are not hosts. */
+static int host_filter(const struct dirent* ent) {
+    return ent->d_name[0] != '.';
+}
+
+static void worker_init(fleet_worker* w,
+                        const context* ctx,
+                        const char* kfile) {
+    /* The excludes are shared, as they are only read. */
+    w->ctx = *ctx;
+    memset(&w->ctx.search_for, 0, sizeof(w->ctx.search_for));
+    memset(&w->ctx.auto_set, 0, sizeof(w->ctx.auto_set));
+    memset(&w->ctx.re, 0, sizeof(w->ctx.re));
+    w->ctx.states_file = NULL;
+    w->ctx.firstarch = NULL;
+    keep_init(&w->ctx.keep);
+    if (kfile)
+        readkeep(&w->ctx.keep, kfile);
+    init_pkg_regex(&w->ctx);
+    snapshot_init(&w->snap, &w->ctx);
+    hash_init(&w->counts, 0);
+}
+
+static void worker_free(fleet_worker* w) {
+    snapshot_free(&w->snap);
+    keep_free(&w->ctx.keep);
+    free_pkg_regex(&w->ctx);
+    free(w->ctx.firstarch);
+    counts_free(&w->counts);
+}
+
+/* Add the orphans of host number n to the worker's counters. Returns -1
+ * and sets errno if the host's status file can't be read, or is set to
+ * EBADMSG if it can't be used, see context.bad_status.
+ */
+static int count_host(fleet_worker* w, const char* path, int n) {
+    stanza_rec* rec;
+    struct stat st;
+    char* content;
+    int err;
+
+    if (stat(path, &st) < 0)
+        return -1;
+    if (!S_ISREG(st.st_mode))
+        return 0;
+    if (!(content = debopen(path)))
+        return -1;
+    if (snapshot_update(&w->snap, content) < 0) {
+        err = errno;
+        free(content);
+        errno = err;
+        return -1;
+    }
+    free(content);
+    forget_file(&w->ctx, path);
+
+    for (rec = w->snap.recs; rec; rec = rec->next) {
+        fleet_count* c;
+
+        if (!rec->orphan)
+            continue;
+        c = count_get(&w->counts, rec->pkg.self.name);
+        if (c->last_host != n) {
+            c->last_host = n;
+            c->hosts++;
+        }
+        c->size += rec->pkg.installed_size;
+    }
+
+    return 0;
+}
+
+static void count_hosts(fleet_job* job, fleet_worker* w) {
+    char* path;
+    int i;
+
+    for (;;) {
+#ifdef HAVE_PTHREAD
+        pthread_mutex_lock(&job->lock);
+#endif
+        i = job->next++;
+#ifdef HAVE_PTHREAD
+        pthread_mutex_unlock(&job->lock);
+#endif
+        if (i >= job->hosts_cnt)
+            break;
+
+        path = malloc(strlen(job->dir) + strlen(job->hosts[i]->d_name) + 2);
+        sprintf(path, "%s/%s", job->dir, job->hosts[i]->d_name);
+        if (count_host(w, path, i) < 0) {
+            fprintf(stderr, "%s: %s: %s\n", program_name, path,
+                    errno == EBADMSG ? bad_status_message(w->ctx.bad_status)
+                                     : strerror(errno));
+#ifdef HAVE_PTHREAD
+            pthread_mutex_lock(&job->lock);
+#endif
+            job->failed++;
+#ifdef HAVE_PTHREAD
+            pthread_mutex_unlock(&job->lock);
+#endif
+        }
+        free(path);
+    }
+}
+
+#ifdef HAVE_PTHREAD
+typedef struct fleet_thread {
+    pthread_t id;
+    fleet_job* job;
+    fleet_worker w;
+} fleet_thread;
+
+static void* count_hosts_thread(void* arg) {
+    fleet_thread* t = arg;
+
+    count_hosts(t->job, &t->w);
+    return NULL;
+}
+#endif
+
+/* Most hosts first, then most space, then by name. */
+static int count_cmp(const void* a, const void* b) {
+    const fleet_count* x = *(fleet_count* const*)a;
+    const fleet_count* y = *(fleet_count* const*)b;
+
+    if (x->hosts != y->hosts)
+        return y->hosts - x->hosts;
+    if (x->size != y->size)
+        return y->size > x->size ? 1 : -1;
+    return strcmp(x->name, y->name);
+}
+
+/* Count the orphans of the status files in dir, keeping the packages in
+ * kfile if it is not NULL, and print the table. Returns the number of
+ * files that could not be read, or -1 if dir can't be.
+ */
+int run_fleet(context* ctx, const char* dir, const char* kfile) {
+    fleet_worker main_worker;
+    fleet_count** rows;
+    fleet_job job;
+    size_t i, n = 0;
+#ifdef HAVE_PTHREAD
+    fleet_thread* threads;
+    int nthreads, t, err;
+#endif
+
+    memset(&job, 0, sizeof(job));
+    job.dir = dir;
+    job.hosts_cnt = scandir(dir, &job.hosts, host_filter, alphasort);
+    if (job.hosts_cnt < 0)
+        return -1;
+
+    worker_init(&main_worker, ctx, kfile);
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_init(&job.lock, NULL);
+    /* This thread is one of them. */
+    nthreads = ctx->options[JOBS] > 1 ? ctx->options[JOBS] - 1 : 0;
+    if (nthreads > job.hosts_cnt - 1)
+        nthreads = job.hosts_cnt > 0 ? job.hosts_cnt - 1 : 0;
+    threads = calloc(nthreads + 1, sizeof(fleet_thread));
+    for (t = 0; t < nthreads; t++) {
+        threads[t].job = &job;
+        worker_init(&threads[t].w, ctx, kfile);
+        if ((err = pthread_create(&threads[t].id, NULL, count_hosts_thread,
+                                  &threads[t])))
+            error(EXIT_FAILURE, err, "pthread_create");
+    }
+    count_hosts(&job, &main_worker);
+    for (t = 0; t < nthreads; t++) {
+        hashtable* counts = &threads[t].w.counts;
+
+        pthread_join(threads[t].id, NULL);
+        /* Every host was counted by one thread only. */
+        for (i = 0; i <= counts->mask; i++) {
+            fleet_count *c = counts->slots[i].value, *sum;
+            if (!c)
+                continue;
+            sum = count_get(&main_worker.counts, c->name);
+            sum->hosts += c->hosts;
+            sum->size += c->size;
+        }
+        worker_free(&threads[t].w);
+    }
+    pthread_mutex_destroy(&job.lock);
+    free(threads);
+#else
+    count_hosts(&job, &main_worker);
+#endif
+
+    rows = malloc((main_worker.counts.used + 1) * sizeof(fleet_count*));
+    for (i = 0; i <= main_worker.counts.mask; i++)
+        if (main_worker.counts.slots[i].value)
+            rows[n++] = main_worker.counts.slots[i].value;
+    qsort(rows, n, sizeof(fleet_count*), count_cmp);
+
+    for (i = 0; i < n; i++)
+        print_fleet_row(ctx, rows[i]->name, rows[i]->hosts, rows[i]->size);
+    print_done(ctx);
+
+    free(rows);
+    worker_free(&main_worker);
+    for (i = 0; i < (size_t)job.hosts_cnt; i++)
+        free(job.hosts[i]);
+    free(job.hosts);
+
+    return job.failed;
+}
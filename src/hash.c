@@ -0,0 +1,143 @@
+/* hash.c - A small hash table for deborphan.
+
+   Distributed under the terms of the MIT License, see the
+   file COPYING provided in this package for details.
+*/
+
+#include <hash.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "deborphan.h"
+
+/* The table is kept at most half full, so probing stays short. */
+#define HASH_MIN_SIZE 64
+
+/* Returns -1 if there is no memory for the table. It is left empty, and
+ * hash_add() tries again. */
+int hash_init(hashtable* t, size_t hint) {
+    size_t size = HASH_MIN_SIZE;
+
+    while (size < hint * 2)
+        size <<= 1;
+
+    t->mask = 0;
+    t->used = 0;
+    if (!(t->slots = calloc(size, sizeof(hash_slot))))
+        return -1;
+    t->mask = size - 1;
+
+    return 0;
+}
+
+void hash_free(hashtable* t) {
+    free(t->slots);
+    t->slots = NULL;
+    t->mask = 0;
+    t->used = 0;
+}
+
+/* Returns -1, leaving the table as it was, if there is no memory. */
+static int hash_grow(hashtable* t) {
+    hash_slot* old = t->slots;
+    size_t i, oldsize = t->mask + 1;
+
+    if (!(t->slots = calloc(oldsize * 2, sizeof(hash_slot)))) {
+        t->slots = old;
+        return -1;
+    }
+    t->mask = oldsize * 2 - 1;
+    t->used = 0;
+
+    for (i = 0; i < oldsize; i++)
+        if (old[i].value)
+            hash_add(t, old[i].hash, old[i].value);
+
+    free(old);
+    return 0;
+}
+
+/* Entries with equal hashes are all kept; hash_find() returns the first
+ * one accepted by the callback. If the table can't grow, it is filled up
+ * further, always leaving one slot empty to end the probing. Returns -1
+ * if value could not be added for lack of memory.
+ */
+int hash_add(hashtable* t, unsigned long long hash, void* value) {
+    size_t i;
+
+    if (!t->slots && hash_init(t, 0) < 0)
+        return -1;
+    if ((t->used + 1) * 2 > t->mask + 1 && hash_grow(t) < 0 &&
+        t->used + 1 > t->mask)
+        return -1;
+
+    for (i = hash & t->mask; t->slots[i].value; i = (i + 1) & t->mask)
+        ;
+
+    t->slots[i].hash = hash;
+    t->slots[i].value = value;
+    t->used++;
+
+    return 0;
+}
+
+void* hash_find(const hashtable* t,
+                unsigned long long hash,
+                hash_eq eq,
+                const void* key) {
+    size_t i;
+
+    if (!t->slots)
+        return NULL;
+
+    for (i = hash & t->mask; t->slots[i].value; i = (i + 1) & t->mask) {
+        if (t->slots[i].hash == hash && (!eq || eq(t->slots[i].value, key)))
+            return t->slots[i].value;
+    }
+
+    return NULL;
+}
+
+static int name_ref_eq(const void* value, const void* key) {
+    return strcmp(((const name_ref*)value)->name, (const char*)key) == 0;
+}
+
+name_ref* name_ref_find(const hashtable* t, const char* name) {
+    return hash_find(t, memhash(name, strlen(name)), name_ref_eq, name);
+}
+
+/* Look up name, adding it with a count of zero if it isn't there yet.
+ * Returns NULL if there is no memory to add it. */
+name_ref* name_ref_get(hashtable* t, const char* name) {
+    unsigned long long h = memhash(name, strlen(name));
+    name_ref* r = hash_find(t, h, name_ref_eq, name);
+
+    if (r)
+        return r;
+
+    if (!(r = malloc(sizeof(name_ref))))
+        return NULL;
+    r->count = 0;
+    r->dirty = 0;
+    if (!(r->name = strdup(name)) || hash_add(t, h, r) < 0) {
+        free(r->name);
+        free(r);
+        return NULL;
+    }
+
+    return r;
+}
+
+void name_ref_free_all(hashtable* t) {
+    size_t i;
+
+    for (i = 0; t->slots && i <= t->mask; i++) {
+        name_ref* r = t->slots[i].value;
+        if (r) {
+            free(r->name);
+            free(r);
+        }
+    }
+    hash_free(t);
+}
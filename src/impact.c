@@ -0,0 +1,123 @@
+/* impact.c - Keeping deborphan out of the way of other programs.
+
+   Distributed under the terms of the MIT License, see the
+   file COPYING provided in this package for details.
+*/
+
+/* --low-impact is for hosts that are busy with something else: deborphan
+ * asks for the disk and the processor only when nobody else wants them,
+ * runs a single thread, and tells the kernel that the status file won't
+ * be read again, so it doesn't push out the pages of the programs that
+ * the host is there for. All of this is advice; what the kernel refuses
+ * is silently done without.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "deborphan.h"
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+/* From linux/ioprio.h, which not every system has. */
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+/* The list of packages and everything around it takes about this many
+ * times the size of the status file. */
+#define LIST_SIZE_FACTOR 3
+
+/* Lower the priority of the process, before any thread is started, as
+ * threads take it over from the one that starts them. */
+void lower_impact(context* ctx) {
+#ifdef SCHED_IDLE
+    struct sched_param param;
+#endif
+
+    ctx->options[JOBS] = 1;
+
+    /* The nice level is what is left if SCHED_IDLE is not allowed. */
+    setpriority(PRIO_PROCESS, 0, 19);
+#ifdef SCHED_IDLE
+    memset(&param, 0, sizeof(param));
+    sched_setscheduler(0, SCHED_IDLE, &param);
+#endif
+#ifdef SYS_ioprio_set
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+            IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#endif
+}
+
+/* Drop the pages of filename from the page cache, unless it is a pipe.
+ * Pages that are still mapped are left alone by the kernel. */
+void forget_file(const context* ctx, const char* filename) {
+#ifdef POSIX_FADV_DONTNEED
+    int fd;
+
+    if (!ctx->options[LOW_IMPACT] || strcmp(filename, "-") == 0)
+        return;
+    if ((fd = open(filename, O_RDONLY | O_NONBLOCK)) < 0)
+        return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+#else
+    (void)ctx;
+    (void)filename;
+#endif
+}
+
+/* Parse a size such as 512M into a number of bytes, or return -1. */
+long parse_size(const char* s) {
+    char* end;
+    long n, unit = 1;
+
+    errno = 0;
+    n = strtol(s, &end, 10);
+    if (errno || end == s || n < 0)
+        return -1;
+    switch (*end) {
+        case 'G':
+        case 'g':
+            unit *= 1024;
+            /* fall through */
+        case 'M':
+        case 'm':
+            unit *= 1024;
+            /* fall through */
+        case 'K':
+        case 'k':
+            unit *= 1024;
+            end++;
+    }
+
+    /* A size that doesn't fit is as wrong as one that isn't a number. */
+    if (*end || n > LONG_MAX / unit)
+        return -1;
+
+    return n * unit;
+}
+
+/* Whether reading sfile into a list of packages would probably take more
+ * than ceiling bytes. The size of a pipe, or of what a compressed file
+ * holds, is not known, and is not held against it. */
+int exceeds_ceiling(const char* sfile, long ceiling) {
+    struct stat st;
+
+    if (strcmp(sfile, "-") == 0 || stat(sfile, &st) < 0 ||
+        !S_ISREG(st.st_mode))
+        return 0;
+
+    return st.st_size > ceiling / LIST_SIZE_FACTOR;
+}
@@ -15,6 +15,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -22,277 +23,373 @@
 
 #include "deborphan.h"
 
-/* If package is a valid package, this function returns 0. On error, it
- * returns -1, if it is not a valid package, it returns the position in
- * the 'args' list +1.
+typedef struct wanted_pkg {
+    const char* name;
+    int found;
+} wanted_pkg;
+
+static int wanted_eq(const void* value, const void* key) {
+    const wanted_pkg* w = value;
+    const char* name = key;
+    size_t len = strlen(w->name);
+
+    /* key is either a name or the rest of a "Package:" line. strchr()
+     * also finds the terminating '\0'. */
+    return strncmp(w->name, name, len) == 0 && strchr(" \t\n", name[len]);
+}
+
+/* Look for the packages in the status file, reading it once. found[i]
+ * is set if pkgnames[i] is there (patterns always are). Returns the
+ * number of packages not found, or -1 if the status file can't be read.
  */
-int pkggrep(const char* sfile, char** pkgnames) {
-    FILE* fp;
-    char *s, *t = NULL;
-    int i = 0;
+int pkggrep(const char* sfile, char** pkgnames, int* found) {
+    wanted_pkg* wanted;
+    hashtable idx;
+    char *content, *line;
+    size_t i, n;
+    int missing = 0;
 
-    if (!(fp = fopen(sfile, "r")))
+    if (!(content = debopen_status(sfile)))
         return -1;
 
-    s = (char*)malloc(200);
+    for (n = 0; pkgnames[n]; n++)
+        ;
+    if (!(wanted = calloc(n ? n : 1, sizeof(wanted_pkg))) ||
+        hash_init(&idx, n) < 0) {
+        free(wanted);
+        free(content);
+        errno = ENOMEM;
+        return -1;
+    }
 
-    while (*pkgnames) {
-        t = (char*)malloc(9 + strlen(*pkgnames));
-        rewind(fp);
+    for (i = 0; i < n; i++) {
+        unsigned long long h = memhash(pkgnames[i], strlen(pkgnames[i]));
+
+        wanted[i].name = pkgnames[i];
+        /* Patterns need not match anything installed right now. */
+        wanted[i].found = is_pattern(pkgnames[i]);
+        /* Of names given twice, only the first goes into the index. */
+        if (!hash_find(&idx, h, wanted_eq, pkgnames[i]) &&
+            hash_add(&idx, h, &wanted[i]) < 0) {
+            hash_free(&idx);
+            free(wanted);
+            free(content);
+            errno = ENOMEM;
+            return -1;
+        }
+    }
 
-        strcpy(t, "ackage:");
-        strcat(t, *pkgnames);
-        strcat(t, "\n");
+    for (line = content; line && *line; line = strchr(line, '\n')) {
+        wanted_pkg* w;
+        size_t len;
 
-        while (fgets(s, 200, fp)) {
-            if (upcase(*s) != 'P')
-                continue;
+        if (*line == '\n')
+            line++;
+        if (upcase(*line) != 'P' || strncasecmp(line, "Package:", 8) != 0)
+            continue;
 
-            strstripchr(s, ' ');
-            if (strcmp(s + 1, t) == 0) {
-                free(s);
-                free(t);
-                fclose(fp);
-                return 0;
-            }
-        }
+        line += 8;
+        line += strspn(line, " \t");
+        len = strcspn(line, " \t\n");
+        if ((w = hash_find(&idx, memhash(line, len), wanted_eq, line)))
+            w->found = 1;
+    }
 
-        i++;
-        pkgnames++;
-        free(t);
+    for (i = 0; i < n; i++) {
+        const wanted_pkg* w = hash_find(
+            &idx, memhash(pkgnames[i], strlen(pkgnames[i])), wanted_eq,
+            pkgnames[i]);
+
+        found[i] = wanted[i].found || w->found;
+        missing += !found[i];
     }
 
-    free(s);
-    fclose(fp);
-    return i;
+    hash_free(&idx);
+    free(wanted);
+    free(content);
+    return missing;
 }
 
-/* Read the entire keep file into memory as an array of `dep's.
- */
-dep* readkeep(const char* kfile) {
-    char* filecontent = debopen(kfile);
-    if (filecontent == NULL)
-        return NULL;
+static int keep_eq(const void* value, const void* key) {
+    return strcmp(((const dep*)value)->name, (const char*)key) == 0;
+}
 
-    dep *d, *ret;
-    d = ret = malloc(10 * sizeof(dep));
+void keep_init(keep_list* k) {
+    k->cnt = 0;
+    k->max = 0;
+    k->names = NULL;
+    hash_init(&k->idx, 0);
+    memset(&k->patterns, 0, sizeof(pattern_set));
+}
 
-    char* line = NULL;
-    char* nextline = filecontent;
+void keep_free(keep_list* k) {
+    size_t i;
 
-    int i = 1;
-    while ((line = strsep(&nextline, "\n"))) {
-        /* skip over leading blanks */
-        line += strspn(line, " \t");
+    for (i = 0; i < k->cnt; i++)
+        free(k->names[i].name);
+    free(k->names);
+    hash_free(&k->idx);
+    pattern_free(&k->patterns);
+    memset(k, 0, sizeof(keep_list));
+}
 
-        /* strip arch suffix et al.*/
-        char* tmp = line;
-        strsep(&tmp, " \t\r\n:#");
+static void rebuild_index(keep_list* k) {
+    size_t i;
 
-        /* skip empty lines */
-        if (line[0] == '\0') {
-            continue;
-        }
+    hash_free(&k->idx);
+    hash_init(&k->idx, k->max);
+    for (i = 0; i < k->cnt; i++)
+        hash_add(&k->idx,
+                 memhash(k->names[i].name, strlen(k->names[i].name)),
+                 &k->names[i]);
+}
 
-        d->name = strdup(line);
-        d->namehash = strhash(d->name);
+/* Add name unless it's there already. Patterns are added like names,
+ * so they can be found and deleted as they were written. Returns -1 if
+ * there is no memory for it.
+ */
+int keep_add(keep_list* k, const char* name, size_t len) {
+    unsigned long long h = memhash(name, len);
+    char* copy = strndup(name, len);
+    dep* names;
 
-        d++;
-        i++;
-        if (i % 10 == 0) {
-            ret = realloc(ret, (i + 10) * sizeof(dep));
-            d = ret + i - 1;
-        }
+    if (!copy)
+        return -1;
+    if (hash_find(&k->idx, h, keep_eq, copy)) {
+        free(copy);
+        return 0;
     }
-    d->name = NULL;
 
-    free(filecontent);
-    return ret;
-}
+    if (k->cnt + 1 >= k->max) {
+        size_t max = k->max ? k->max * 2 : 64;
 
-int mustkeep(const dep d) {
-    dep* c;
+        if (!(names = realloc(k->names, max * sizeof(dep)))) {
+            free(copy);
+            return -1;
+        }
+        k->names = names;
+        k->max = max;
+        /* The index points into names[]. */
+        rebuild_index(k);
+    }
 
-    for (c = keep; c && c->name; c++) {
-        if (pkgcmp(*c, d))
-            return 1;
+    if ((is_pattern(copy) && pattern_add(&k->patterns, copy) < 0) ||
+        hash_add(&k->idx, h, &k->names[k->cnt]) < 0) {
+        free(copy);
+        return -1;
     }
+    k->names[k->cnt].name = copy;
+    k->names[k->cnt].arch = NULL;
+    k->names[k->cnt].namehash = strhash(copy);
+    k->cnt++;
+    k->names[k->cnt].name = NULL;
 
     return 0;
 }
 
-int addkeep(const char* kfile, char** add) {
-    int c;
+/* Returns the length of the package name on a line of a keep file, and
+ * where it starts in *name.
+ */
+static size_t keep_line(const char* line, const char** name) {
+    /* skip over leading blanks */
+    line += strspn(line, " \t");
+    *name = line;
 
-    FILE* fp = fopen(kfile, "a+");
-    if (fp == NULL) {
-        error(EXIT_FAILURE, errno, "Opening %s", kfile);
-    }
+    /* strip arch suffix et al.*/
+    return strcspn(line, " \t\r\n:#");
+}
 
-    if (fseek(fp, 0L, SEEK_END) < 0) {
-        error(EXIT_FAILURE, errno, "fseek on %s", kfile);
-    }
+/* Add the entries of the keep file to k. Returns -1 if the file can't
+ * be read, or there is no memory for its entries.
+ */
+int readkeep(keep_list* k, const char* kfile) {
+    char *filecontent, *line, *nextline;
+    const char* name;
+    size_t len;
 
-    if (ftell(fp) != 0L) {
-        // ... check if the final newline is missing ...
-        if (fseek(fp, -1L, SEEK_END) < 0) {
-            error(EXIT_FAILURE, errno, "fseek on %s", kfile);
-        }
-        c = fgetc(fp);
-        if (fseek(fp, 0L, SEEK_END) < 0) {
-            error(EXIT_FAILURE, errno, "fseek on %s", kfile);
-        }
-        if (c != EOF && c != '\n') {
-            // ... and add '\n' if appropriate.
-            fputc('\n', fp);
-        }
-    }
+    if (!(filecontent = debopen(kfile)))
+        return -1;
 
-    int i = 0;
-    while (*add) {
-        if (**add && **add != '\n') {
-            fputs(*add, fp);
-            fputc('\n', fp);
+    nextline = filecontent;
+    while ((line = strsep(&nextline, "\n"))) {
+        /* skip empty lines */
+        if ((len = keep_line(line, &name)) > 0 &&
+            keep_add(k, name, len) < 0) {
+            free(filecontent);
+            return -1;
         }
-        add++;
-        i++;
     }
 
-    fclose(fp);
-    return i;
+    free(filecontent);
+    return 0;
 }
 
-/* Sure, this function will never win the Function of the Year award, but
- * at least we got rid of the temporary files. Now all I/O is done in
- * memory.
+/* Read the keep file and, unless disabled, debfoster's keepers file.
+ * Entries in both are only kept once.
  */
-int delkeep(const char* kfile, char** del) {
-    int fd, cnt;
-    struct stat sbuf;
-    char *fcont, *orig, *end;
+void readkeep_all(keep_list* k, const char* kfile, int no_debfoster) {
+    keep_init(k);
+    readkeep(k, kfile);
+
+#ifdef DEBFOSTER_KEEP
+    if (!no_debfoster)
+        readkeep(k, DEBFOSTER_KEEP);
+#else
+    (void)no_debfoster;
+#endif
+}
 
-    if ((fd = open(kfile, O_RDONLY | O_CREAT, 0666 /* let umask handle -w */)) <
-        0)
-        return -1;
+static int keep_has(const keep_list* k, const char* name) {
+    return hash_find(&k->idx, memhash(name, strlen(name)), keep_eq, name) !=
+           NULL;
+}
 
-    if (fstat(fd, &sbuf) < 0) {
-        close(fd);
-        return -1;
-    }
+/* A package that can't be matched for lack of memory is rather kept than
+ * reported. */
+int mustkeep(keep_list* k, const dep d) {
+    return keep_has(k, d.name) || pattern_match(&k->patterns, d.name);
+}
 
-    for (cnt = 0; del[cnt]; cnt++)
-        ;
+/* Write the keep file anew, without the entries in del and with those in
+ * add appended. The new content goes to a temporary file that is renamed
+ * over kfile, so readers see either the old or the new list. If kfile is
+ * a symbolic link, the file it points to is replaced, with the same owner
+ * and mode. Returns the number of entries removed, or -1 on error.
+ */
+static int rewritekeep(const char* kfile, char** del, char** add) {
+    keep_list gone;
+    struct stat sbuf;
+    char *fcont = NULL, *real = NULL, *line, *next, *tmp;
+    const char *name, *path = kfile;
+    size_t len;
+    int fd, removed = 0, err;
+    FILE* fp;
 
-    orig = fcont = (char*)malloc(sbuf.st_size + 1);
+    keep_init(&gone);
+    for (; del && *del; del++) {
+        if (**del && keep_add(&gone, *del, strlen(*del)) < 0) {
+            keep_free(&gone);
+            return -1;
+        }
+    }
 
-    ssize_t actually_read = read(fd, fcont, sbuf.st_size);
-    if (actually_read < 0 || (size_t)actually_read != sbuf.st_size) {
-        free(fcont);
-        close(fd);
+    if (stat(kfile, &sbuf) < 0) {
+        mode_t mask;
+
+        if (errno != ENOENT) {
+            keep_free(&gone);
+            return -1;
+        }
+        /* As if it had been created by open(). */
+        mask = umask(0);
+        umask(mask);
+        sbuf.st_mode = 0666 & ~mask;
+    } else if (!(fcont = debopen(kfile))) {
+        keep_free(&gone);
         return -1;
+    } else if ((real = realpath(kfile, NULL))) {
+        path = real;
     }
-    end = fcont + sbuf.st_size;
-    *end = '\0';
-
-    char* tok;
-    while ((tok = strsep(&fcont, "\n"))) {
-        char* substr = tok;
-        size_t substrlen;
-        substr += strspn(substr, " \t");
-        substrlen = strcspn(substr, " \t\r\n:#");
-        if (substrlen > 0) {
-            for (int i = 0; i < cnt; i++) {
-                if (strlen(del[i]) != substrlen)
-                    continue;
-                if (strncmp(del[i], substr, substrlen) == 0) {
-                    // found package to remove from keeplist.
-                    memmove(tok, fcont, end - fcont + 1);
-                    end -= fcont - tok;
-                    fcont = tok;
-                    break;
-                }
-            }
+
+    if (!(tmp = malloc(strlen(path) + sizeof(".XXXXXX")))) {
+        err = errno;
+        goto fail;
+    }
+    strcpy(tmp, path);
+    strcat(tmp, ".XXXXXX");
+    if ((fd = mkstemp(tmp)) < 0 || !(fp = fdopen(fd, "w"))) {
+        err = errno;
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp);
         }
+        goto fail;
     }
-    close(fd);
-
-    // undo what strsep() did.
-    fcont = orig;
-    while (1) {
-        size_t len = strlen(fcont);
-        if (fcont + len < end) {
-            fcont[len] = '\n';
-            fcont += len;
-        } else {
-            break;
+    fchmod(fd, sbuf.st_mode & 07777);
+    /* Only root can hand the file to someone else, for anyone else it
+     * becomes their own. */
+    if (fcont && fchown(fd, sbuf.st_uid, sbuf.st_gid) < 0 && errno != EPERM) {
+        err = errno;
+        fclose(fp);
+        unlink(tmp);
+        goto fail;
+    }
+
+    for (next = fcont; next && *next;) {
+        line = strsep(&next, "\n");
+        if ((len = keep_line(line, &name)) > 0) {
+            char* end = (char*)name + len;
+            char c = *end;
+            int hit;
+
+            *end = '\0';
+            hit = keep_has(&gone, name);
+            *end = c;
+            if (hit) {
+                removed++;
+                continue;
+            }
         }
+        fputs(line, fp);
+        fputc('\n', fp);
     }
 
-    if ((fd = open(kfile, O_WRONLY | O_TRUNC)) < 0) {
-        free(orig);
-        return -1;
+    for (; add && *add; add++) {
+        if (**add && **add != '\n') {
+            fputs(*add, fp);
+            fputc('\n', fp);
+        }
     }
 
-    ssize_t actually_wrote = write(fd, orig, end - orig);
-    if (actually_wrote < 0 || (size_t)actually_wrote != (end - orig)) {
-        error(EXIT_FAILURE, errno,
-              "Writing keep file failed and may be corrupt now");
-        free(orig);
-        close(fd);
-        return -1;
+    if (ferror(fp) | fclose(fp) || rename(tmp, path) < 0) {
+        err = errno;
+        unlink(tmp);
+        goto fail;
     }
 
-    free(orig);
-    close(fd);
-    return 0;
+    free(tmp);
+    free(real);
+    free(fcont);
+    keep_free(&gone);
+    return removed;
+
+fail:
+    free(tmp);
+    free(real);
+    free(fcont);
+    keep_free(&gone);
+    errno = err;
+    return -1;
 }
 
-/* If something in list is found in keep, this function returns its
- * position in the list +1, else it returns 0.
- */
-int hasduplicate(char** list) {
+int addkeep(const char* kfile, char** add) {
     int i;
-    dep d;
 
-    for (i = 0; list[i]; i++) {
-        d.name = list[i];
-        d.namehash = strhash(list[i]);
-        if (mustkeep(d))
-            return i + 1;
-    }
+    if (rewritekeep(kfile, NULL, add) < 0)
+        return -1;
+    for (i = 0; add[i]; i++)
+        ;
 
-    return 0;
+    return i;
 }
 
-dep* mergekeep(const dep* a, const dep* b) {
-    unsigned int i = 0, j = 0, x = 0, y = 0;
-    dep* ret;
-
-    if (!(a || b))
-        return NULL;
-
-    if (a)
-        while (a[i++].name) {
-        };
-    if (b)
-        while (b[j++].name) {
-        };
-
-    ret = (dep*)malloc(sizeof(dep) * (j + i));
+/* Returns the number of entries removed, or -1 on error. */
+int delkeep(const char* kfile, char** del) {
+    return rewritekeep(kfile, del, NULL);
+}
 
-    for (i = 0; a && a[i].name; i++)
-        ret[i] = a[i];
+/* If something in list is found in k, this function returns its
+ * position in the list +1, else it returns 0. Only an entry written as
+ * it is in k is found, one that a pattern of k matches is not.
+ */
+int hasduplicate(keep_list* k, char** list) {
+    int i;
 
-    for (j = 0; b && b[j].name; j++) {
-        for (x = 0, y = 0; ret[x].name; x++) {
-            if (pkgcmp(ret[x], b[j]))
-                y = 1;
-        }
-        if (!y)
-            ret[i++] = b[j];
-    }
+    for (i = 0; list[i]; i++)
+        if (keep_has(k, list[i]))
+            return i + 1;
 
-    return ret;
+    return 0;
 }
 
 int listkeep(const char* kfile) {
@@ -326,7 +423,8 @@ char** parseargs(int argind, int argc, char** argv) {
     int i = 0;
     int s = 50;
     char** ret = (char**)calloc(s, sizeof(char*));
-    char t[100];
+    char* t = NULL;
+    size_t n = 0;
 
     for (; argind < argc; argind++) {
         if (i == s - 1) {
@@ -334,16 +432,15 @@ char** parseargs(int argind, int argc, char** argv) {
             ret = (char**)realloc(ret, s * sizeof(char*));
         }
         if (argv[argind][0] == '-' && argv[argind][1] == '\0') {
-            while (fgets(t, 100, stdin)) {
+            while (getline(&t, &n, stdin) > 0) {
                 if (i == s - 1) {
                     s *= 2;
                     ret = (char**)realloc(ret, s * sizeof(char*));
                 }
-                ret[i] = (char*)malloc((strlen(t) + 1));
                 strstripchr(t, ' ');
                 strstripchr(t, '\r');
                 strstripchr(t, '\n');
-                strcpy(ret[i++], t);
+                ret[i++] = strdup(t);
             }
         } else {
             ret[i++] = strdup(argv[argind]);
@@ -351,6 +448,7 @@ char** parseargs(int argind, int argc, char** argv) {
     }
 
     ret[i] = NULL;
+    free(t);
 
     return ret;
 }
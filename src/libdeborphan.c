@@ -0,0 +1,361 @@
+/* libdeborphan.c - The interface of libdeborphan.
+
+   Distributed under the terms of the MIT License, see the
+   file COPYING provided in this package for details.
+*/
+
+/* A handle is a context and a snapshot of the status file, the same
+ * that --cache-file and --serve use: loading a status file again only
+ * parses the stanzas that changed, and a changed profile is picked up by
+ * the snapshot's fingerprints the next time it is brought up to date.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cache.h>
+#include <libdeborphan.h>
+
+#include "config.h"
+#include "deborphan.h"
+
+struct deborphan {
+    context ctx;
+    snapshot snap;
+    char* content; /* of the status file loaded last */
+    size_t len;
+    int stale; /* the snapshot is older than the profile or content */
+};
+
+static const struct {
+    const char* name;
+    int flags;
+} guesses[] = {
+    {"all", GUESS_ALL},
+    {"common", GUESS_COMMON},
+    {"data", GUESS_DATA},
+    {"debug", GUESS_DEBUG},
+    {"dev", GUESS_DEV},
+    {"doc", GUESS_DOC},
+    {"dummy", GUESS_DUMMY},
+    {"interpreters", GUESS_IP},
+    {"java", GUESS_JAVA},
+    {"kernel", GUESS_KERNEL},
+    {"mono", GUESS_MONO},
+    {"perl", GUESS_PERL},
+    {"pike", GUESS_PIKE},
+    {"python", GUESS_PYTHON},
+    {"ruby", GUESS_RUBY},
+    {"section", GUESS_SECTION},
+};
+
+deborphan* deborphan_new(void) {
+    deborphan* d = calloc(1, sizeof(deborphan));
+
+    if (!d)
+        return NULL;
+    context_init(&d->ctx);
+    keep_init(&d->ctx.keep);
+    snapshot_init(&d->snap, &d->ctx);
+    d->stale = 1;
+
+    return d;
+}
+
+void deborphan_free(deborphan* d) {
+    size_t i;
+
+    if (!d)
+        return;
+    snapshot_free(&d->snap);
+    /* add_exclude() doesn't copy the names, deborphan_exclude() does. */
+    for (i = 0; i < d->ctx.exclude_list_cnt; i++)
+        free(d->ctx.exclude_list[i].name);
+    context_free(&d->ctx);
+    free(d->content);
+    free(d);
+}
+
+int deborphan_set(deborphan* d, deborphan_option option, int value) {
+    int* o = d->ctx.options;
+
+    switch (option) {
+        case DEBORPHAN_ALL_PACKAGES:
+            o[ALL_PACKAGES] = value;
+            break;
+        case DEBORPHAN_PRIORITY:
+            o[PRIORITY] = value;
+            break;
+        case DEBORPHAN_IGNORE_RECOMMENDS:
+            o[IGNORE_RECOMMENDS] = value;
+            break;
+        case DEBORPHAN_IGNORE_SUGGESTS:
+            o[IGNORE_SUGGESTS] = value;
+            break;
+        case DEBORPHAN_FORCE_HOLD:
+            o[FORCE_HOLD] = value;
+            break;
+        case DEBORPHAN_EXCLUDE_DEV:
+            if (value)
+                o[IGNORE_LIBS] |= IGNORE_LIB_DEV;
+            else
+                o[IGNORE_LIBS] &= ~IGNORE_LIB_DEV;
+            break;
+        case DEBORPHAN_LIBDEVEL:
+            o[SEARCH_LIBDEVEL] = value;
+            break;
+        case DEBORPHAN_GUESS_ONLY:
+            o[GUESS_ONLY] = value;
+            break;
+        case DEBORPHAN_FIND_CONFIG:
+            o[FIND_CONFIG] = value;
+            /* As with the command line, --find-config implies -a. */
+            if (value)
+                o[ALL_PACKAGES] = 1;
+            break;
+        case DEBORPHAN_AUTO_ONLY:
+            o[AUTO_ONLY] = value;
+            break;
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+    d->stale = 1;
+
+    return 0;
+}
+
+int deborphan_guess(deborphan* d, const char* name, int on) {
+    size_t i;
+
+    for (i = 0; i < sizeof(guesses) / sizeof(guesses[0]); i++) {
+        if (strcmp(name, guesses[i].name) != 0)
+            continue;
+        if (on)
+            guess_set(&d->ctx, guesses[i].flags);
+        else
+            guess_clr(&d->ctx, guesses[i].flags);
+        d->stale = 1;
+        return 0;
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+int deborphan_keep(deborphan* d, const char* name) {
+    if (keep_add(&d->ctx.keep, name, strcspn(name, ":")) < 0)
+        return -1;
+    d->stale = 1;
+
+    return 0;
+}
+
+int deborphan_read_keep(deborphan* d, const char* path) {
+    if (readkeep(&d->ctx.keep, path) < 0)
+        return -1;
+    d->stale = 1;
+
+    return 0;
+}
+
+int deborphan_exclude(deborphan* d, const char* name) {
+    char* copy = strdup(name);
+
+    if (!copy)
+        return -1;
+    if (add_exclude(&d->ctx, copy) < 0) {
+        free(copy);
+        return -1;
+    }
+    d->stale = 1;
+
+    return 0;
+}
+
+int deborphan_read_auto(deborphan* d, const char* path) {
+    if (read_extended_states(&d->ctx, path) < 0)
+        return -1;
+    d->stale = 1;
+
+    return 0;
+}
+
+static int update(deborphan* d);
+
+/* Parse content right away, so that a status file that can't be used is
+ * refused here, and the one loaded before stays. */
+static int load(deborphan* d, char* content, size_t len) {
+    char* old = d->content;
+    size_t oldlen = d->len;
+    int stale = d->stale, err;
+
+    d->content = content;
+    d->len = len;
+    d->stale = 1;
+
+    if ((!d->ctx.states_file || read_extended_states(&d->ctx, NULL) == 0) &&
+        update(d) == 0) {
+        free(old);
+        return 0;
+    }
+
+    err = errno;
+    free(content);
+    d->content = old;
+    d->len = oldlen;
+    /* Running out of memory may have emptied the snapshot. */
+    d->stale = err == EBADMSG ? stale : 1;
+    errno = err;
+
+    return -1;
+}
+
+int deborphan_load_file(deborphan* d, const char* path) {
+    char* content = debopen_status(path);
+
+    if (!content)
+        return -1;
+    return load(d, content, strlen(content));
+}
+
+int deborphan_load_buffer(deborphan* d, const char* buf, size_t len) {
+    char* content = malloc(len + 1);
+
+    if (!content)
+        return -1;
+    memcpy(content, buf, len);
+    content[len] = '\0';
+    return load(d, content, len);
+}
+
+/* Bring the snapshot up to date with the profile and the content. */
+static int update(deborphan* d) {
+    char* copy;
+
+    if (!d->stale)
+        return 0;
+    if (!d->content) {
+        errno = ENODATA;
+        return -1;
+    }
+    /* snapshot_update() cuts the content into stanzas. */
+    if (!(copy = malloc(d->len + 1)))
+        return -1;
+    memcpy(copy, d->content, d->len + 1);
+
+    /* The regular expressions depend on the --guess options. */
+    free_pkg_regex(&d->ctx);
+    memset(&d->ctx.re, 0, sizeof(d->ctx.re));
+    init_pkg_regex(&d->ctx);
+
+    if (snapshot_update(&d->snap, copy) < 0) {
+        int err = errno;
+
+        free(copy);
+        errno = err;
+        return -1;
+    }
+    free(copy);
+    d->stale = 0;
+
+    return 0;
+}
+
+static void to_pkg(const pkg_info* p, deborphan_pkg* out) {
+    out->name = p->self.name;
+    out->arch = p->self.arch;
+    out->section = p->section;
+    out->priority = priority_to_string(p->priority);
+    out->installed_size = p->installed_size;
+}
+
+int deborphan_orphans(deborphan* d, deborphan_cb cb, void* data) {
+    deborphan_pkg pkg;
+    stanza_rec* rec;
+    int cnt = 0;
+
+    if (update(d) < 0)
+        return -1;
+
+    for (rec = d->snap.recs; rec; rec = rec->next) {
+        if (!rec->orphan)
+            continue;
+        to_pkg(&rec->pkg, &pkg);
+        cnt++;
+        if (cb(&pkg, data))
+            break;
+    }
+
+    return cnt;
+}
+
+/* Returns 1 if p depends on what target is or provides. */
+static int depends_on(const pkg_info* p, const pkg_info* target) {
+    int i, j;
+
+    for (i = 0; i < p->deps_cnt; i++) {
+        if (pkgcmp(target->self, p->deps[i]))
+            return 1;
+        for (j = 0; j < target->provides_cnt; j++)
+            if (pkgcmp(target->provides[j], p->deps[i]))
+                return 1;
+    }
+
+    return 0;
+}
+
+int deborphan_dependents(deborphan* d,
+                         const char* name,
+                         deborphan_cb cb,
+                         void* data) {
+    const pkg_info **targets = NULL, **more;
+    deborphan_pkg pkg;
+    stanza_rec* rec;
+    size_t len = strcspn(name, ":"), ntargets = 0, i;
+    const char* arch = name[len] ? name + len + 1 : NULL;
+    int cnt = 0;
+
+    if (update(d) < 0)
+        return -1;
+
+    /* Without an architecture, name may be several packages. */
+    for (rec = d->snap.recs; rec; rec = rec->next) {
+        const dep* self = &rec->pkg.self;
+
+        if (!rec->inlist || !self->name || strncmp(self->name, name, len) ||
+            self->name[len])
+            continue;
+        if (arch && (!self->arch || strcmp(self->arch, arch)))
+            continue;
+        more = realloc(targets, (ntargets + 1) * sizeof(pkg_info*));
+        if (!more) {
+            free(targets);
+            return -1;
+        }
+        targets = more;
+        targets[ntargets++] = &rec->pkg;
+    }
+    if (!ntargets) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    for (rec = d->snap.recs; rec; rec = rec->next) {
+        if (!rec->inlist)
+            continue;
+        for (i = 0; i < ntargets; i++)
+            if (depends_on(&rec->pkg, targets[i]))
+                break;
+        if (i == ntargets)
+            continue;
+        to_pkg(&rec->pkg, &pkg);
+        cnt++;
+        if (cb(&pkg, data))
+            break;
+    }
+
+    free(targets);
+    return cnt;
+}
@@ -8,6 +8,8 @@
    file COPYING provided in this package for details.
 */
 
+#include <errno.h>
+#include <fnmatch.h>
 #include <regex.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,86 +18,108 @@
 #include "config.h"
 #include "deborphan.h"
 
-extern int options[];
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
-static int print_arch_suffix(pkg_info* pkg) {
-    if (pkg->self.arch)
-        return printf(":%s", pkg->self.arch);
-    return 0;
+/* The names of the FILTER_* bits, lowest first. */
+static const char* const filter_names[] = {
+    "excluded", "not-config-files", "held",      "not-auto-installed",
+    "priority", "kept",             "essential", "not-a-library"};
+
+/* Work out why current_pkg is not to be checked at all, as FILTER_*
+ * bits. With all, every reason found is returned, otherwise only the
+ * first one. all is a constant wherever this is inlined, so the checks
+ * for the packages that are not explained stop as early as they did.
+ */
+static inline __attribute__((always_inline)) unsigned int filter(
+    context* ctx,
+    pkg_info* current_pkg,
+    const int all) {
+    unsigned int reasons = 0;
+
+#define FILTER_IF(cond, bit)    \
+    do {                        \
+        if (cond) {             \
+            reasons |= (bit);   \
+            if (!all)           \
+                return reasons; \
+        }                       \
+    } while (0)
+
+    FILTER_IF(current_pkg->excluded, FILTER_EXCLUDED);
+    FILTER_IF(ctx->options[FIND_CONFIG] && !current_pkg->config,
+              FILTER_NOT_CONFIG);
+    FILTER_IF(current_pkg->hold, FILTER_HELD);
+    FILTER_IF(ctx->options[AUTO_ONLY] && !current_pkg->auto_installed,
+              FILTER_NOT_AUTO);
+    FILTER_IF(current_pkg->priority < ctx->options[PRIORITY],
+              FILTER_PRIORITY);
+    FILTER_IF(ctx->keep.cnt && mustkeep(&ctx->keep, current_pkg->self),
+              FILTER_KEPT);
+    if (!is_library(ctx, current_pkg, ctx->options[SEARCH_LIBDEVEL])) {
+#ifndef IGNORE_ESSENTIAL
+        /* is_library() turns down essential packages in any section. */
+        if (!ctx->options[ALL_PACKAGES] && current_pkg->section &&
+            current_pkg->essential)
+            reasons |= FILTER_ESSENTIAL;
+        else
+#endif
+            reasons |= FILTER_NOT_LIBRARY;
+    }
+
+#undef FILTER_IF
+
+    return reasons;
 }
 
-/* For each package found, this scans the `package' structure, to
- * see if anything depends on it.
+/* The name of the lowest of the FILTER_* bits in reasons, or NULL if
+ * there is none.
  */
-void check_lib_deps(pkg_info* package,
-                    pkg_info* current_pkg,
-                    int print_suffix) {
-    int deps, prov, no_dep_found = 1, search_found = 1;
-    int i;
-    static int j;
+const char* filter_name(unsigned int reasons) {
+    size_t i;
 
-    extern dep* search_for;
+    for (i = 0; i < sizeof(filter_names) / sizeof(filter_names[0]); i++)
+        if (reasons & (1u << i))
+            return filter_names[i];
 
-   if (options[FIND_CONFIG] && !current_pkg->config)
-        return;
-    if (current_pkg->hold)
-        return;
-    if (current_pkg->priority < options[PRIORITY])
-        return;
-    if (keep && mustkeep(current_pkg->self))
-        return;
-    if (!is_library(current_pkg, options[SEARCH_LIBDEVEL]))
-        return;
+    return NULL;
+}
 
-    if (options[SEARCH]) {
-        search_found = 0;
-        /* Count packages. Just once. */
-        if (!j)
-            for (; search_for[j].name; j++)
-                ;
-
-        /* Search for the package, and clear it from the list if it is
-           found. */
-        for (i = 0; search_for[i].name; i++) {
-            if (strcmp(search_for[i].name, current_pkg->self.name) == 0) {
-                if (search_for[i].arch == NULL ||
-                    (current_pkg->self.arch != NULL &&
-                     (strcmp(search_for[i].arch, current_pkg->self.arch) ==
-                      0))) {
-                    --j;
-                    search_for[i].name = search_for[j].name;
-                    search_for[i].arch = search_for[j].arch;
-                    search_for[i].namehash = search_for[j].namehash;
-                    search_for[j].name = NULL;
-                    search_found = 1;
-                    break;
-                }
-            }
-        }
-    }
-    if (!search_found)
-        return;
+/* Returns every reason current_pkg is not checked, see --explain-filter. */
+unsigned int filter_reasons(context* ctx, pkg_info* current_pkg) {
+    return filter(ctx, current_pkg, 1);
+}
 
-    if (options[SHOW_DEPS]) {
-        printf("%s", current_pkg->self.name);
-
-        if (print_suffix)
-            print_arch_suffix(current_pkg);
-
-        if (options[SHOW_SECTION] > 0)
-            printf(" (%s", current_pkg->section);
-        if (options[SHOW_PRIORITY])
-            printf(" - %s", priority_to_string(current_pkg->priority));
-        if (options[SHOW_SIZE])
-            printf(", %ld", current_pkg->installed_size);
-        if (options[SHOW_SECTION] > 0)
-            printf(")");
-        printf("\n");
-    }
+/* Returns why current_pkg is not to be checked at all, i.e. it is
+ * filtered out by its state, how it was installed, its priority, the
+ * keep list or its section, or NULL if it is to be checked.
+ */
+const char* candidate_reason(context* ctx, pkg_info* current_pkg) {
+    return filter_name(filter(ctx, current_pkg, 0));
+}
 
-    /* Search all (installed) packages for dependencies.
-     */
-    for (; package && no_dep_found; package = package->next) {
+int is_candidate(context* ctx, pkg_info* current_pkg) {
+    return candidate_reason(ctx, current_pkg) == NULL;
+}
+
+/* Look for the packages in the `package' list that depend on current_pkg
+ * or on something it provides. With show_deps, every one found is
+ * printed, otherwise the first one ends the search. Returns 1 if there
+ * is one.
+ *
+ * show_deps is a constant wherever this is inlined, so every kernel
+ * built from it has loops of its own that test no option.
+ */
+static inline __attribute__((always_inline)) int scan_dependents(
+    const context* ctx,
+    pkg_info* package,
+    pkg_info* current_pkg,
+    int print_suffix,
+    const int show_deps) {
+    int deps, prov, found = 0;
+
+    for (; package; package = package->next) {
         /* We assume that a multiarch-dependency pkg:arch is only satisfied by
          * a package that has pkg as package name or provides pkg to make an
          * older deborphan compatible with future versions of the multiarch
@@ -112,55 +136,472 @@ void check_lib_deps(pkg_info* package,
 		continue;
 #endif
 
-        for (deps = 0; deps < package->deps_cnt && no_dep_found; deps++) {
-            for (prov = 0; prov < current_pkg->provides_cnt && no_dep_found;
-                 prov++) {
+        for (deps = 0; deps < package->deps_cnt; deps++) {
+            for (prov = 0; prov < current_pkg->provides_cnt; prov++) {
                 if (pkgcmp(current_pkg->provides[prov], package->deps[deps])) {
-                    if (options[SHOW_DEPS]) {
-                        printf("      %s", package->self.name);
-                        if (print_suffix)
-                            print_arch_suffix(package);
-                        putchar('\n');
-                    } else
-                        no_dep_found = 0;
+                    if (!show_deps)
+                        return 1;
+                    print_dependent(ctx, package, print_suffix);
+                    found = 1;
                 }
             }
 
             if (pkgcmp(current_pkg->self, package->deps[deps])) {
-                if (options[SHOW_DEPS]) {
-                    printf("      %s", package->self.name);
-                    if (print_suffix)
-                        print_arch_suffix(package);
-                    putchar('\n');
-                } else
-                    no_dep_found = 0;
+                if (!show_deps)
+                    return 1;
+                print_dependent(ctx, package, print_suffix);
+                found = 1;
             }
         }
     }
 
-    if (no_dep_found && !options[SHOW_DEPS] &&
-        (!options[IGNORE_LIBS] || !is_pkg_dev(current_pkg))) {
-        size_t prntd;
+    return found;
+}
+
+/* Returns 1 if any package in the `package' list depends on current_pkg
+ * or on something it provides.
+ */
+int has_dependents(pkg_info* package, pkg_info* current_pkg) {
+    return scan_dependents(NULL, package, current_pkg, 0, 0);
+}
+
+/* Returns 1 if current_pkg, a candidate, is only reported if nothing
+ * depends on it. dpkg keeps no dependencies for a package of which only
+ * the configuration files are left, and what is left can be purged
+ * whatever names it, see run_find_config().
+ */
+int needs_dependents_check(const pkg_info* current_pkg) {
+    return !current_pkg->config;
+}
+
+/* Returns 1 if current_pkg would be reported even though nothing
+ * depends on it.
+ */
+int is_reported(const context* ctx, pkg_info* current_pkg) {
+    return !ctx->options[IGNORE_LIBS] || !is_pkg_dev(current_pkg);
+}
 
-        if (options[SHOW_SIZE])
-            printf("%10ld ", current_pkg->installed_size);
+static int search_eq(const void* value, const void* key) {
+    return strcmp(((const dep*)value)->name, (const char*)key) == 0;
+}
+
+void search_init(search_list* s, dep* pkgs) {
+    size_t i;
 
-        if (options[SHOW_SECTION] > 0)
-            printf("%-25s ", current_pkg->section);
+    for (s->cnt = 0; pkgs[s->cnt].name; s->cnt++)
+        ;
+    s->given = s->cnt;
+    s->pkgs = pkgs;
+    s->found = calloc(s->cnt + 1, sizeof(int));
+    s->next_same = malloc((s->cnt + 1) * sizeof(int));
+    hash_init(&s->idx, s->cnt);
 
-        prntd = printf("%s", current_pkg->self.name);
-        if (print_suffix)
-            prntd += print_arch_suffix(current_pkg);
+    for (i = 0; i < s->cnt; i++) {
+        unsigned long long h = memhash(pkgs[i].name, strlen(pkgs[i].name));
+        dep* first = hash_find(&s->idx, h, search_eq, pkgs[i].name);
+        int j;
 
-        if (options[SHOW_PRIORITY]) {
-            size_t sz = 24;
-            if (print_suffix)
-                sz += 6;
-            while (sz > prntd++)
-                putchar(' ');
-            printf(" %s", priority_to_string(current_pkg->priority));
+        s->next_same[i] = -1;
+        if (!first) {
+            hash_add(&s->idx, h, &pkgs[i]);
+            continue;
         }
+        for (j = first - pkgs; s->next_same[j] >= 0; j = s->next_same[j])
+            ;
+        s->next_same[j] = i;
+    }
+}
+
+static int name_cmp(const void* a, const void* b) {
+    return strcmp((*(pkg_info* const*)a)->self.name,
+                  (*(pkg_info* const*)b)->self.name);
+}
+
+/* Compare two names from their last character on. */
+static int rname_cmp(const void* a, const void* b) {
+    const char* x = (*(pkg_info* const*)a)->self.name;
+    const char* y = (*(pkg_info* const*)b)->self.name;
+    size_t i = strlen(x), j = strlen(y);
+
+    while (i && j) {
+        unsigned char c = x[--i], d = y[--j];
+
+        if (c != d)
+            return c - d;
+    }
+
+    return (i > 0) - (j > 0);
+}
+
+typedef int literal_cmp(const char* name, const char* lit, size_t len);
+
+static int prefix_cmp(const char* name, const char* lit, size_t len) {
+    return strncmp(name, lit, len);
+}
+
+/* Compare the end of name to the len characters of lit, in the order of
+ * rname_cmp(). */
+static int suffix_cmp(const char* name, const char* lit, size_t len) {
+    size_t nlen = strlen(name), k;
+
+    for (k = 1; k <= len; k++) {
+        unsigned char c, d = lit[len - k];
+
+        if (k > nlen)
+            return -1;
+        if ((c = name[nlen - k]) != d)
+            return c - d;
+    }
+
+    return 0;
+}
+
+/* Find the range [*lo, *hi) of the n sorted names that begin, or end,
+ * with the len characters of lit. */
+static void literal_range(pkg_info** names,
+                          size_t n,
+                          literal_cmp* cmp,
+                          const char* lit,
+                          size_t len,
+                          size_t* lo,
+                          size_t* hi) {
+    size_t l = 0, h = n;
+
+    while (l < h) {
+        size_t mid = l + (h - l) / 2;
+        if (cmp(names[mid]->self.name, lit, len) < 0)
+            l = mid + 1;
+        else
+            h = mid;
+    }
+    *lo = l;
+
+    for (h = n; l < h;) {
+        size_t mid = l + (h - l) / 2;
+        if (cmp(names[mid]->self.name, lit, len) <= 0)
+            l = mid + 1;
+        else
+            h = mid;
+    }
+    *hi = l;
+}
+
+/* Replace the patterns in the search list by the packages they match.
+ * The names are sorted once by their beginning and, if a pattern needs
+ * it, once by their end; a pattern is only compared to the range of
+ * names with its longer literal prefix or suffix, which is all there is
+ * to do for a pattern like "libboost*". Only a pattern with neither,
+ * like "?lib*", is compared to every name.
+ */
+void search_expand(search_list* s, pkg_info* package) {
+    pkg_info **names, **rnames = NULL, **tab, *p;
+    dep* pkgs;
+    size_t i, cnt = 0, n = 0, max, given = s->given;
+    int* matched;
+
+    for (i = 0; i < s->cnt; i++)
+        if (is_pattern(s->pkgs[i].name))
+            break;
+    if (i == s->cnt)
+        return;
+
+    for (p = package; p; p = p->next)
+        cnt += p->self.name != NULL;
+    names = malloc((cnt + 1) * sizeof(pkg_info*));
+    for (p = package; p; p = p->next)
+        if (p->self.name)
+            names[n++] = p;
+    qsort(names, n, sizeof(pkg_info*), name_cmp);
+
+    max = s->cnt + 16;
+    pkgs = malloc(max * sizeof(dep));
+    memcpy(pkgs, s->pkgs, s->cnt * sizeof(dep));
+    cnt = s->cnt;
+    matched = calloc(s->cnt, sizeof(int));
+
+    for (i = 0; i < s->cnt; i++) {
+        const dep* want = &s->pkgs[i];
+        const char* end = want->name + strlen(want->name);
+        const char* suffix = end;
+        size_t len = strcspn(want->name, "*?[\\");
+        size_t lo, hi;
+        /* "prefix*" matches the whole range. */
+        int range = strcmp(want->name + len, "*") == 0;
+
+        if (!want->name[len])
+            continue;
+
+        while (suffix > want->name && !strchr("*?[]\\", suffix[-1]))
+            suffix--;
+        if ((size_t)(end - suffix) > len) {
+            if (!rnames) {
+                rnames = malloc((n + 1) * sizeof(pkg_info*));
+                memcpy(rnames, names, n * sizeof(pkg_info*));
+                qsort(rnames, n, sizeof(pkg_info*), rname_cmp);
+            }
+            tab = rnames;
+            literal_range(tab, n, suffix_cmp, suffix, end - suffix, &lo, &hi);
+        } else {
+            tab = names;
+            literal_range(tab, n, prefix_cmp, want->name, len, &lo, &hi);
+        }
+
+        for (; lo < hi; lo++) {
+            const dep* self = &tab[lo]->self;
+
+            if (want->arch && (!self->arch || strcmp(want->arch, self->arch)))
+                continue;
+            if (!range && fnmatch(want->name, self->name, 0) != 0)
+                continue;
+
+            if (cnt + 1 >= max) {
+                max *= 2;
+                pkgs = realloc(pkgs, max * sizeof(dep));
+            }
+            pkgs[cnt].name = self->name;
+            pkgs[cnt].arch = self->arch;
+            pkgs[cnt].namehash = self->namehash;
+            cnt++;
+            matched[i] = 1;
+        }
+    }
+    pkgs[cnt].name = NULL;
+
+    free(s->found);
+    free(s->next_same);
+    hash_free(&s->idx);
+    search_init(s, pkgs);
+
+    /* Only what was given is reported as missing, and a pattern is
+     * found if it matched anything. */
+    s->given = given;
+    for (i = 0; i < given; i++)
+        s->found[i] = matched[i];
+
+    free(matched);
+    free(rnames);
+    free(names);
+}
+
+/* Look for self in the search list, and mark the first matching entry
+ * found. Returns 1 if there was one.
+ */
+int search_take(search_list* s, const dep* self) {
+    dep* first;
+    int i;
+
+    if (!self->name)
+        return 0;
+    first = hash_find(&s->idx, memhash(self->name, strlen(self->name)),
+                      search_eq, self->name);
+    if (!first)
+        return 0;
+
+    for (i = first - s->pkgs; i >= 0; i = s->next_same[i]) {
+        const char* arch = s->pkgs[i].arch;
+
+        if (s->found[i])
+            continue;
+        if (!arch || (self->arch && strcmp(arch, self->arch) == 0)) {
+            s->found[i] = 1;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Returns 1 if current_pkg is to be checked. In search mode, this marks
+ * it found in the search list.
+ */
+static int is_checked(context* ctx, pkg_info* current_pkg) {
+    if (!is_candidate(ctx, current_pkg))
+        return 0;
+
+    /* Search for the package, and mark it in the list if it is found. */
+    if (ctx->options[SEARCH] &&
+        !search_take(&ctx->search_for, &current_pkg->self))
+        return 0;
+
+    return 1;
+}
+
+/* The kernels checking a candidate, one for each way of reporting it.
+ * Which one is used is decided once per run by pick_check().
+ */
+typedef void check_fn(const context* ctx,
+                      pkg_info* package,
+                      pkg_info* current_pkg,
+                      int print_suffix);
+
+/* Print current_pkg if nothing depends on it. */
+static void check_orphan(const context* ctx,
+                         pkg_info* package,
+                         pkg_info* current_pkg,
+                         int print_suffix) {
+    if ((!needs_dependents_check(current_pkg) ||
+         !scan_dependents(ctx, package, current_pkg, print_suffix, 0)) &&
+        is_reported(ctx, current_pkg))
+        print_orphan(ctx, current_pkg, print_suffix);
+}
+
+/* Print current_pkg with everything that depends on it, for
+ * --show-deps.
+ */
+static void check_show_deps(const context* ctx,
+                            pkg_info* package,
+                            pkg_info* current_pkg,
+                            int print_suffix) {
+    print_deps_begin(ctx, current_pkg, print_suffix);
+    scan_dependents(ctx, package, current_pkg, print_suffix, 1);
+    print_deps_end(ctx);
+}
+
+static check_fn* pick_check(const context* ctx) {
+    return ctx->options[SHOW_DEPS] ? check_show_deps : check_orphan;
+}
+
+/* For each package found, this scans the `package' structure, to
+ * see if anything depends on it.
+ */
+void check_lib_deps(context* ctx,
+                    pkg_info* package,
+                    pkg_info* current_pkg,
+                    int print_suffix) {
+    if (is_checked(ctx, current_pkg))
+        pick_check(ctx)(ctx, package, current_pkg, print_suffix);
+}
+
+#ifdef HAVE_PTHREAD
+/* Packages are handed out to the threads in chunks of this many. */
+#define CHECK_CHUNK 16
+
+typedef struct check_job {
+    const context* ctx;
+    check_fn* check;
+    pkg_info* package;
+    pkg_info** todo;
+    size_t todo_cnt;
+    out_chunk* out;
+    size_t next; /* the next chunk to take */
+    pthread_mutex_t lock;
+    int print_suffix;
+} check_job;
+
+static void* check_chunks(void* arg) {
+    check_job* job = arg;
+    size_t chunk, i;
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        chunk = job->next++;
+        pthread_mutex_unlock(&job->lock);
+
+        if (chunk * CHECK_CHUNK >= job->todo_cnt)
+            break;
+
+        out_capture(&job->out[chunk]);
+        for (i = chunk * CHECK_CHUNK;
+             i < job->todo_cnt && i < (chunk + 1) * CHECK_CHUNK; i++)
+            job->check(job->ctx, job->package, job->todo[i],
+                       job->print_suffix);
+        out_capture(NULL);
+    }
+
+    return NULL;
+}
+
+/* Which packages to check is decided up front, as the search list and
+ * the keep patterns are not to be shared. The checks themselves are
+ * spread over options[JOBS] threads, which take the next chunk of
+ * packages whenever they are done with one; each chunk is printed to a
+ * buffer of its own, and the buffers are printed in the order of the
+ * packages, just as check_orphans() would have.
+ */
+static void check_orphans_parallel(context* ctx,
+                                   pkg_info* package,
+                                   int print_suffix) {
+    pkg_info* this;
+    pthread_t* threads;
+    check_job job;
+    size_t max = 0, chunks, i;
+    int cnt, err;
+
+    memset(&job, 0, sizeof(job));
+    job.ctx = ctx;
+    job.check = pick_check(ctx);
+    job.package = package;
+    job.print_suffix = print_suffix;
+    for (this = package; this->next; this = this->next) {
+        if (!is_checked(ctx, this))
+            continue;
+        if (job.todo_cnt == max) {
+            max = max ? max * 2 : 256;
+            job.todo = realloc(job.todo, max * sizeof(pkg_info*));
+        }
+        job.todo[job.todo_cnt++] = this;
+    }
+
+    chunks = (job.todo_cnt + CHECK_CHUNK - 1) / CHECK_CHUNK;
+    job.out = calloc(chunks + 1, sizeof(out_chunk));
+    pthread_mutex_init(&job.lock, NULL);
+
+    /* Everything shared by the threads has to be in place first. */
+    print_header(ctx);
+
+    /* This thread is one of them. */
+    cnt = ctx->options[JOBS] - 1;
+    if ((size_t)cnt > chunks)
+        cnt = chunks;
+    threads = malloc((cnt + 1) * sizeof(pthread_t));
+    for (i = 0; i < (size_t)cnt; i++) {
+        if ((err = pthread_create(&threads[i], NULL, check_chunks, &job)))
+            error(EXIT_FAILURE, err, "pthread_create");
+    }
+    check_chunks(&job);
+    for (i = 0; i < (size_t)cnt; i++)
+        pthread_join(threads[i], NULL);
+
+    for (i = 0; i < chunks; i++)
+        out_release(&job.out[i]);
+
+    pthread_mutex_destroy(&job.lock);
+    free(threads);
+    free(job.out);
+    free(job.todo);
+}
+#endif /* HAVE_PTHREAD */
+
+/* Check every package in the list, which ends in an empty package. */
+void check_orphans(context* ctx, pkg_info* package, int print_suffix) {
+    check_fn* check;
+    pkg_info* this;
+
+#ifdef HAVE_PTHREAD
+    if (ctx->options[JOBS] > 1) {
+        check_orphans_parallel(ctx, package, print_suffix);
+        return;
+    }
+#endif
+
+    check = pick_check(ctx);
+    for (this = package; this->next; this = this->next)
+        if (is_checked(ctx, this))
+            check(ctx, package, this, print_suffix);
+}
+
+/* For --explain-filter, print every package in the list, or only those
+ * asked for on the command line, with all the reasons it is not checked
+ * for dependents, or none if it is.
+ */
+void explain_filter(context* ctx, pkg_info* package, int print_suffix) {
+    pkg_info* this;
 
-        printf("\n");
+    print_header(ctx);
+    for (this = package; this->next; this = this->next) {
+        if (ctx->search_for.cnt &&
+            !search_take(&ctx->search_for, &this->self))
+            continue;
+        print_explained(ctx, this, filter_reasons(ctx, this), print_suffix);
     }
 }
@@ -0,0 +1,230 @@
+/* lowmem.c - Finding orphans in little memory for deborphan.
+
+   Distributed under the terms of the MIT License, see the
+   file COPYING provided in this package for details.
+*/
+
+/* With --low-memory, no list of packages is built. The status file is
+ * mapped, not read, and gone through twice, one package at a time:
+ *
+ * The first pass notes what every package in the list depends on, as
+ * the 64 bit hash of the name. The hashes are kept in an array that is
+ * sorted and rid of duplicates whenever it is full, and only grown if
+ * that doesn't free half of it, so it holds a few times the number of
+ * distinct names depended on at most.
+ *
+ * The second pass reports the candidates of which neither the name nor
+ * anything they provide is in the array.
+ *
+ * Only the lines get_pkg_stanza() looks at are copied out of the file,
+ * so what is kept besides the array is one package with the field lines
+ * of its stanza, no matter how long the descriptions are. Two names with
+ * the same hash can only make a package look depended on, so at worst an
+ * orphan is missed, and never is a package reported that is needed.
+ */
+
+#include <errno.h>
+#include <set.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "deborphan.h"
+
+/* The sizes are those of the array of hashes. */
+#define HASHES_MIN_SIZE 1024
+
+typedef struct name_hashes {
+    unsigned long long* v;
+    size_t cnt;
+    size_t max;
+} name_hashes;
+
+typedef struct scanner {
+    const char* p;
+    const char* end;
+    char* fields; /* the field lines of the current stanza */
+    size_t max;
+} scanner;
+
+static int hash_cmp(const void* a, const void* b) {
+    unsigned long long x = *(const unsigned long long*)a;
+    unsigned long long y = *(const unsigned long long*)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Sort the hashes and drop the duplicates. */
+static void hashes_compact(name_hashes* h) {
+    size_t i, n = 0;
+
+    if (!h->cnt)
+        return;
+    qsort(h->v, h->cnt, sizeof(h->v[0]), hash_cmp);
+    for (i = 1; i < h->cnt; i++)
+        if (h->v[i] != h->v[n])
+            h->v[++n] = h->v[i];
+    h->cnt = n + 1;
+}
+
+static void hashes_add(name_hashes* h, const char* name) {
+    if (h->cnt == h->max) {
+        hashes_compact(h);
+        if (h->cnt >= h->max / 2) {
+            h->max = h->max ? h->max * 2 : HASHES_MIN_SIZE;
+            h->v = realloc(h->v, h->max * sizeof(h->v[0]));
+            if (!h->v)
+                error(EXIT_FAILURE, errno, "low-memory");
+        }
+    }
+    h->v[h->cnt++] = memhash(name, strlen(name));
+}
+
+/* Only once hashes_compact() is done. */
+static int hashes_has(const name_hashes* h, const char* name) {
+    unsigned long long key = memhash(name, strlen(name));
+
+    return h->cnt &&
+           bsearch(&key, h->v, h->cnt, sizeof(h->v[0]), hash_cmp) != NULL;
+}
+
+/* Copy the field lines of the next stanza to s->fields, leaving out the
+ * continuation lines, which get_pkg_stanza() skips anyway. Returns 0
+ * when there are no more stanzas.
+ */
+static int next_fields(scanner* s) {
+    size_t len = 0, n;
+    const char *line, *nl;
+
+    while (s->p < s->end) {
+        line = s->p;
+        nl = memchr(line, '\n', s->end - line);
+        n = (nl ? nl : s->end) - line;
+        s->p = nl ? nl + 1 : s->end;
+
+        if (!n) {
+            /* Empty stanzas are skipped, they make no package. */
+            if (len)
+                break;
+            continue;
+        }
+        if (*line == '\0' || !strchr("AIPpSsEeDdRr", *line))
+            continue;
+
+        if (len + n + 1 > s->max) {
+            while (len + n + 1 > s->max)
+                s->max = s->max ? s->max * 2 : 4096;
+            if (!(s->fields = realloc(s->fields, s->max)))
+                error(EXIT_FAILURE, errno, "low-memory");
+        }
+        memcpy(s->fields + len, line, n);
+        s->fields[len + n] = '\n';
+        len += n + 1;
+    }
+
+    if (!len)
+        return 0;
+    s->fields[len - 1] = '\0';
+
+    return 1;
+}
+
+/* Parse the next package into pkg, and return 1 if read_status() would
+ * have put it in the list, 0 if not, or -1 at the end of the file.
+ */
+static int next_package(context* ctx,
+                        scanner* s,
+                        pkg_info* pkg,
+                        int* multiarch) {
+    reinit_pkg(pkg);
+    if (!next_fields(s))
+        return -1;
+    get_pkg_stanza(ctx, s->fields, pkg, multiarch);
+
+    if ((!pkg->install && !ctx->options[FIND_CONFIG]) ||
+        is_excluded(ctx, &pkg->self))
+        return 0;
+    if (ctx->options[AUTO_ONLY])
+        pkg->auto_installed = is_auto_installed(ctx, &pkg->self);
+
+    return 1;
+}
+
+static int is_depended_on(const name_hashes* h, const pkg_info* pkg) {
+    int i;
+
+    if (hashes_has(h, pkg->self.name))
+        return 1;
+    for (i = 0; i < pkg->provides_cnt; i++)
+        if (hashes_has(h, pkg->provides[i].name))
+            return 1;
+
+    return 0;
+}
+
+/* Print the orphans of sfile in two passes over it. Returns -1 if it
+ * can't be read.
+ */
+int run_lowmem(context* ctx, const char* sfile) {
+    name_hashes depended = {NULL, 0, 0};
+    scanner s = {NULL, NULL, NULL, 0};
+    pkg_info pkg;
+    char* content;
+    size_t len;
+    int mapped, multiarch = 0, print_suffix, r, i;
+
+    /* Laying dpkg's journal over the file takes a copy of it, as does
+     * reading it from a pipe. */
+    mapped = !status_has_updates(sfile) && (content = debmap(sfile, &len));
+    if (!mapped) {
+        if (!(content = debopen_status(sfile)))
+            return -1;
+        len = strlen(content);
+    }
+
+    init_pkg(&pkg);
+
+    s.p = content;
+    s.end = content + len;
+    ctx->bad_status = STATUS_OK;
+    while (!ctx->bad_status &&
+           (r = next_package(ctx, &s, &pkg, &multiarch)) >= 0) {
+        if (!r)
+            continue;
+        for (i = 0; i < pkg.deps_cnt; i++)
+            hashes_add(&depended, pkg.deps[i].name);
+    }
+    if (ctx->bad_status)
+        exit_bad_status(ctx->bad_status);
+    hashes_compact(&depended);
+
+#ifdef DEBUG
+    fprintf(stderr, "%lu names depended on, room for %lu.\n",
+            (unsigned long)depended.cnt, (unsigned long)depended.max);
+#endif /* DEBUG */
+
+    print_suffix = (ctx->options[SHOW_ARCH] == ALWAYS ||
+                    (ctx->options[SHOW_ARCH] == DEFAULT && multiarch));
+
+    s.p = content;
+    while ((r = next_package(ctx, &s, &pkg, &multiarch)) >= 0) {
+        if (!r || !is_candidate(ctx, &pkg) ||
+            (needs_dependents_check(&pkg) && is_depended_on(&depended, &pkg)))
+            continue;
+        if (is_reported(ctx, &pkg))
+            print_orphan(ctx, &pkg, print_suffix);
+    }
+    print_done(ctx);
+
+    reinit_pkg(&pkg);
+    free(s.fields);
+    free(depended.v);
+    if (mapped)
+        debunmap(content, len);
+    else
+        free(content);
+    forget_file(ctx, sfile);
+
+    return 0;
+}
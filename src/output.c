@@ -0,0 +1,528 @@
+/* output.c - Formatting and buffering the results of deborphan.
+
+   Distributed under the terms of the MIT License, see the
+   file COPYING provided in this package for details.
+*/
+
+/* Everything deborphan reports on stdout is assembled here, in one
+ * buffer that is written out with a single write() whenever it fills up
+ * and by out_flush(). Besides the text format, which is what deborphan
+ * always printed, there are three formats meant for other programs:
+ *
+ *   jsonl  one JSON object per package with the fields name, arch,
+ *          section, priority and size, plus dependents with -d
+ *   tsv    the same fields, tab separated, after a header line
+ *   nul    only the names, each terminated by a NUL character
+ *
+ * The machine readable formats always carry all fields, whatever the
+ * --show-* options say. With --root, every package is preceded by the
+ * root it was found in: a "root" field in JSON, a first column in TSV,
+ * a NUL terminated string of its own in nul and "ROOT: " in front of
+ * every line of text.
+ *
+ * Threads checking packages in parallel each collect their output in an
+ * out_chunk of their own instead, see out_capture().
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "deborphan.h"
+
+#define OUT_BUFSIZE (64 * 1024)
+
+static char out_buf[OUT_BUFSIZE];
+static size_t out_len;
+static int header_done;
+static __thread int dependents_cnt;
+static __thread out_chunk* capture;
+
+void out_flush(void) {
+    size_t done = 0;
+
+    while (done < out_len) {
+        ssize_t n = write(STDOUT_FILENO, out_buf + done, out_len - done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            error(EXIT_FAILURE, errno, "write");
+        }
+        done += n;
+    }
+    out_len = 0;
+}
+
+static void out_write(const char* s, size_t len) {
+    if (capture) {
+        if (capture->len + len > capture->max) {
+            capture->max = capture->max ? capture->max * 2 : OUT_BUFSIZE;
+            if (capture->max < capture->len + len)
+                capture->max = capture->len + len;
+            capture->buf = realloc(capture->buf, capture->max);
+            if (!capture->buf)
+                error(EXIT_FAILURE, errno, "output");
+        }
+        memcpy(capture->buf + capture->len, s, len);
+        capture->len += len;
+        return;
+    }
+
+    if (out_len + len > OUT_BUFSIZE) {
+        out_flush();
+        /* Larger than the buffer itself, don't bother copying. */
+        if (len > OUT_BUFSIZE) {
+            while (len) {
+                ssize_t n = write(STDOUT_FILENO, s, len);
+                if (n < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    error(EXIT_FAILURE, errno, "write");
+                }
+                s += n;
+                len -= n;
+            }
+            return;
+        }
+    }
+    memcpy(out_buf + out_len, s, len);
+    out_len += len;
+}
+
+static void out_str(const char* s) {
+    out_write(s, strlen(s));
+}
+
+static void out_char(char c) {
+    if (capture) {
+        out_write(&c, 1);
+        return;
+    }
+    if (out_len == OUT_BUFSIZE)
+        out_flush();
+    out_buf[out_len++] = c;
+}
+
+static void out_spaces(size_t n) {
+    while (n--)
+        out_char(' ');
+}
+
+/* Returns the number of characters written, as printf() does. */
+static int out_printf(const char* format, ...) {
+    char small[256], *big = NULL;
+    va_list args;
+    int len;
+
+    va_start(args, format);
+    len = vsnprintf(small, sizeof(small), format, args);
+    va_end(args);
+
+    if (len >= (int)sizeof(small)) {
+        big = malloc(len + 1);
+        va_start(args, format);
+        vsnprintf(big, len + 1, format, args);
+        va_end(args);
+    }
+    out_write(big ? big : small, len);
+    free(big);
+
+    return len;
+}
+
+/* Send what the calling thread prints to chunk instead of stdout, until
+ * it is called again with NULL.
+ */
+void out_capture(out_chunk* chunk) {
+    capture = chunk;
+}
+
+/* Print what was collected in chunk, and free it. */
+void out_release(out_chunk* chunk) {
+    out_write(chunk->buf, chunk->len);
+    free(chunk->buf);
+    chunk->buf = NULL;
+    chunk->len = chunk->max = 0;
+}
+
+/* name, or name:arch if print_suffix is set. Returns the length. */
+static size_t out_name(const pkg_info* p, int print_suffix) {
+    size_t len = strlen(p->self.name);
+
+    out_write(p->self.name, len);
+    if (print_suffix && p->self.arch)
+        len += out_printf(":%s", p->self.arch);
+
+    return len;
+}
+
+static void out_json_str(const char* s) {
+    if (!s) {
+        out_str("null");
+        return;
+    }
+
+    out_char('"');
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            out_char('\\');
+            out_char(c);
+        } else if (c < 0x20) {
+            out_printf("\\u%04x", c);
+        } else {
+            out_char(c);
+        }
+    }
+    out_char('"');
+}
+
+/* Fields can't contain tabs or newlines in TSV. */
+static void out_tsv_str(const char* s) {
+    if (!s) {
+        out_char('-');
+        return;
+    }
+    for (; *s; s++)
+        out_char(*s == '\t' || *s == '\n' ? ' ' : *s);
+}
+
+static void out_tsv_header(const context* ctx) {
+    if (header_done)
+        return;
+    header_done = 1;
+    if (ctx->options[FLEET]) {
+        out_str("name\thosts\tsize\n");
+        return;
+    }
+    if (ctx->options[DIFF]) {
+        out_str("change\tname\tarch\tsize\n");
+        return;
+    }
+    if (ctx->options[ROOTS])
+        out_str("root\t");
+    out_str("name\tarch\tsection\tpriority\tsize");
+    if (ctx->options[EXPLAIN_FILTER])
+        out_str("\treasons");
+    else if (ctx->options[SHOW_DEPS])
+        out_str("\tdependents");
+    out_char('\n');
+}
+
+/* The root a line is about with --root, in the text and nul formats. */
+static void out_root(const context* ctx) {
+    if (!ctx->root)
+        return;
+    out_str(ctx->root);
+    if (ctx->options[FORMAT] == FORMAT_NUL)
+        out_char('\0');
+    else
+        out_str(": ");
+}
+
+static void out_fields(const context* ctx, const pkg_info* p) {
+    if (ctx->options[FORMAT] == FORMAT_JSONL) {
+        out_char('{');
+        if (ctx->root) {
+            out_str("\"root\": ");
+            out_json_str(ctx->root);
+            out_str(", ");
+        }
+        out_str("\"name\": ");
+        out_json_str(p->self.name);
+        out_str(", \"arch\": ");
+        out_json_str(p->self.arch);
+        out_str(", \"section\": ");
+        out_json_str(p->section);
+        out_str(", \"priority\": ");
+        out_json_str(priority_to_string(p->priority));
+        out_printf(", \"size\": %ld", p->installed_size);
+    } else {
+        out_tsv_header(ctx);
+        if (ctx->root) {
+            out_tsv_str(ctx->root);
+            out_char('\t');
+        }
+        out_tsv_str(p->self.name);
+        out_char('\t');
+        out_tsv_str(p->self.arch);
+        out_char('\t');
+        out_tsv_str(p->section);
+        out_char('\t');
+        out_tsv_str(priority_to_string(p->priority));
+        out_printf("\t%ld", p->installed_size);
+    }
+}
+
+/* Print the line for an orphaned package in the plain (not --show-deps)
+ * format.
+ */
+void print_orphan(const context* ctx, pkg_info* current_pkg, int print_suffix) {
+    size_t prntd;
+
+    switch (ctx->options[FORMAT]) {
+        case FORMAT_JSONL:
+            out_fields(ctx, current_pkg);
+            out_str("}\n");
+            return;
+        case FORMAT_TSV:
+            out_fields(ctx, current_pkg);
+            out_char('\n');
+            return;
+        case FORMAT_NUL:
+            out_root(ctx);
+            out_name(current_pkg, print_suffix);
+            out_char('\0');
+            return;
+    }
+
+    out_root(ctx);
+
+    if (ctx->options[SHOW_SIZE])
+        out_printf("%10ld ", current_pkg->installed_size);
+
+    if (ctx->options[SHOW_SECTION] > 0)
+        out_printf("%-25s ", current_pkg->section);
+
+    prntd = out_name(current_pkg, print_suffix);
+
+    if (ctx->options[SHOW_PRIORITY]) {
+        size_t sz = 24;
+        if (print_suffix)
+            sz += 6;
+        if (sz > prntd)
+            out_spaces(sz - prntd);
+        out_printf(" %s", priority_to_string(current_pkg->priority));
+    }
+
+    out_char('\n');
+}
+
+/* The head of a package's entry with --show-deps; its dependents follow
+ * with print_dependent() and print_deps_end() closes the entry.
+ */
+void print_deps_begin(const context* ctx,
+                      pkg_info* current_pkg,
+                      int print_suffix) {
+    dependents_cnt = 0;
+
+    switch (ctx->options[FORMAT]) {
+        case FORMAT_JSONL:
+            out_fields(ctx, current_pkg);
+            out_str(", \"dependents\": [");
+            return;
+        case FORMAT_TSV:
+            out_fields(ctx, current_pkg);
+            out_char('\t');
+            return;
+        case FORMAT_NUL:
+            out_root(ctx);
+            out_name(current_pkg, print_suffix);
+            out_char('\0');
+            return;
+    }
+
+    out_root(ctx);
+
+    out_name(current_pkg, print_suffix);
+
+    if (ctx->options[SHOW_SECTION] > 0)
+        out_printf(" (%s", current_pkg->section);
+    if (ctx->options[SHOW_PRIORITY])
+        out_printf(" - %s", priority_to_string(current_pkg->priority));
+    if (ctx->options[SHOW_SIZE])
+        out_printf(", %ld", current_pkg->installed_size);
+    if (ctx->options[SHOW_SECTION] > 0)
+        out_char(')');
+    out_char('\n');
+}
+
+void print_dependent(const context* ctx,
+                     pkg_info* dependent,
+                     int print_suffix) {
+    switch (ctx->options[FORMAT]) {
+        case FORMAT_JSONL:
+            if (dependents_cnt)
+                out_str(", ");
+            out_char('"');
+            out_name(dependent, 1);
+            out_char('"');
+            break;
+        case FORMAT_TSV:
+            if (dependents_cnt)
+                out_char(',');
+            out_name(dependent, 1);
+            break;
+        case FORMAT_NUL:
+            break;
+        default:
+            out_root(ctx);
+            out_str("      ");
+            out_name(dependent, print_suffix);
+            out_char('\n');
+    }
+    dependents_cnt++;
+}
+
+void print_deps_end(const context* ctx) {
+    if (ctx->options[FORMAT] == FORMAT_JSONL)
+        out_str("]}\n");
+    else if (ctx->options[FORMAT] == FORMAT_TSV)
+        out_char('\n');
+}
+
+/* A line of the table of --fleet: name is an orphan on that many hosts,
+ * where it takes size KiB altogether.
+ */
+void print_fleet_row(const context* ctx,
+                     const char* name,
+                     int hosts,
+                     long size) {
+    switch (ctx->options[FORMAT]) {
+        case FORMAT_JSONL:
+            out_str("{\"name\": ");
+            out_json_str(name);
+            out_printf(", \"hosts\": %d, \"size\": %ld}\n", hosts, size);
+            break;
+        case FORMAT_TSV:
+            out_tsv_header(ctx);
+            out_tsv_str(name);
+            out_printf("\t%d\t%ld\n", hosts, size);
+            break;
+        case FORMAT_NUL:
+            out_str(name);
+            out_char('\0');
+            break;
+        default:
+            out_printf("%8d %12ld ", hosts, size);
+            out_str(name);
+            out_char('\n');
+    }
+}
+
+/* A line of --diff: name became an orphan (sign is `+') or is no longer
+ * one (`-').
+ */
+void print_change(const context* ctx,
+                  int sign,
+                  const char* name,
+                  const char* arch,
+                  long size,
+                  int print_suffix) {
+    switch (ctx->options[FORMAT]) {
+        case FORMAT_JSONL:
+            out_str(sign == '+' ? "{\"change\": \"added\", \"name\": "
+                                : "{\"change\": \"removed\", \"name\": ");
+            out_json_str(name);
+            out_str(", \"arch\": ");
+            out_json_str(arch);
+            out_printf(", \"size\": %ld}\n", size);
+            return;
+        case FORMAT_TSV:
+            out_tsv_header(ctx);
+            out_char(sign);
+            out_char('\t');
+            out_tsv_str(name);
+            out_char('\t');
+            out_tsv_str(arch);
+            out_printf("\t%ld\n", size);
+            return;
+    }
+
+    out_char(sign);
+    if (ctx->options[FORMAT] == FORMAT_TEXT)
+        out_printf("%10ld ", size);
+    out_str(name);
+    if (print_suffix && arch)
+        out_printf(":%s", arch);
+    out_char(ctx->options[FORMAT] == FORMAT_NUL ? '\0' : '\n');
+}
+
+/* A line of --explain-filter: the FILTER_* reasons current_pkg is not
+ * checked, separated by commas, or "candidate" in text if there are none.
+ */
+void print_explained(const context* ctx,
+                     pkg_info* current_pkg,
+                     unsigned int reasons,
+                     int print_suffix) {
+    unsigned int bit;
+    int n = 0;
+
+    switch (ctx->options[FORMAT]) {
+        case FORMAT_JSONL:
+            out_fields(ctx, current_pkg);
+            out_str(", \"reasons\": [");
+            break;
+        case FORMAT_TSV:
+            out_fields(ctx, current_pkg);
+            out_char('\t');
+            break;
+        default:
+            out_root(ctx);
+            out_name(current_pkg, print_suffix);
+            if (ctx->options[FORMAT] == FORMAT_NUL)
+                out_char('\0');
+            else
+                out_str(": ");
+    }
+
+    for (bit = 1; bit && bit <= reasons; bit <<= 1) {
+        if (!(reasons & bit))
+            continue;
+        if (n++)
+            out_str(ctx->options[FORMAT] == FORMAT_JSONL ? ", " : ",");
+        if (ctx->options[FORMAT] == FORMAT_JSONL)
+            out_json_str(filter_name(bit));
+        else
+            out_str(filter_name(bit));
+    }
+
+    switch (ctx->options[FORMAT]) {
+        case FORMAT_JSONL:
+            out_str("]}\n");
+            break;
+        case FORMAT_NUL:
+            out_char('\0');
+            break;
+        case FORMAT_TSV:
+            out_char('\n');
+            break;
+        default:
+            if (!reasons)
+                out_str("candidate");
+            out_char('\n');
+    }
+}
+
+/* The packages found with --purge-list, on one line, separated by
+ * spaces, as dpkg --purge takes them. Nothing is printed if there are
+ * none.
+ */
+void print_purge_list(pkg_info** pkgs, size_t cnt, int print_suffix) {
+    size_t i;
+
+    for (i = 0; i < cnt; i++) {
+        out_name(pkgs[i], print_suffix);
+        out_char(i + 1 < cnt ? ' ' : '\n');
+    }
+}
+
+/* Print what comes before the packages, i.e. the TSV header. Threads
+ * capturing their output rely on this being done beforehand.
+ */
+void print_header(const context* ctx) {
+    if (ctx->options[FORMAT] == FORMAT_TSV)
+        out_tsv_header(ctx);
+}
+
+/* Called once everything has been printed; in TSV, the header is
+ * printed even without a package.
+ */
+void print_done(const context* ctx) {
+    print_header(ctx);
+    out_flush();
+}
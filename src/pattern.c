@@ -0,0 +1,289 @@
+/* pattern.c - Matching package names against many globs at once.
+
+   Distributed under the terms of the MIT License, see the
+   file COPYING provided in this package for details.
+*/
+
+#include <pattern.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "deborphan.h"
+
+/* pattern_state.next[] entries that are no state. STATE_NOMEM is never
+ * stored, it is what get_state() returns if there is no memory. */
+#define STATE_NOMEM (-3)
+#define STATE_UNKNOWN (-2)
+#define STATE_DEAD (-1)
+
+int is_pattern(const char* s) {
+    return strpbrk(s, "*?") != NULL;
+}
+
+/* Returns the new node, or -1 if there is no memory for it. */
+static int new_node(pattern_set* p) {
+    pattern_node* n;
+
+    if (p->nodes_cnt == p->nodes_max) {
+        int max = p->nodes_max ? p->nodes_max * 2 : 64;
+
+        if (!(n = realloc(p->nodes, max * sizeof(pattern_node))))
+            return -1;
+        p->nodes = n;
+        p->nodes_max = max;
+    }
+
+    n = &p->nodes[p->nodes_cnt];
+    n->edges = NULL;
+    n->edges_cnt = 0;
+    n->any = n->star = -1;
+    n->loop = n->accept = 0;
+
+    return p->nodes_cnt++;
+}
+
+static void free_states(pattern_set* p) {
+    int i;
+
+    for (i = 0; i < p->states_cnt; i++) {
+        free(p->states[i]->nodes);
+        free(p->states[i]);
+    }
+    free(p->states);
+    p->states = NULL;
+    p->states_cnt = p->states_max = 0;
+    hash_free(&p->state_idx);
+}
+
+int pattern_init(pattern_set* p) {
+    memset(p, 0, sizeof(pattern_set));
+    return new_node(p); /* the root */
+}
+
+void pattern_free(pattern_set* p) {
+    int i;
+
+    for (i = 0; i < p->nodes_cnt; i++)
+        free(p->nodes[i].edges);
+    free(p->nodes);
+    free_states(p);
+    memset(p, 0, sizeof(pattern_set));
+}
+
+static int edge(pattern_set* p, int from, unsigned char c) {
+    pattern_node* n = &p->nodes[from];
+    pattern_edge* edges;
+    int i, to;
+
+    for (i = 0; i < n->edges_cnt; i++)
+        if (n->edges[i].c == c)
+            return n->edges[i].node;
+
+    if ((to = new_node(p)) < 0)
+        return -1;
+    n = &p->nodes[from]; /* new_node() may have moved it */
+    edges = realloc(n->edges, (n->edges_cnt + 1) * sizeof(pattern_edge));
+    if (!edges)
+        return -1;
+    n->edges = edges;
+    n->edges[n->edges_cnt].c = c;
+    n->edges[n->edges_cnt].node = to;
+    n->edges_cnt++;
+
+    return to;
+}
+
+/* Returns -1 if there is no memory for the pattern. The nodes that were
+ * added for it are left over, but accept nothing. */
+int pattern_add(pattern_set* p, const char* pattern) {
+    int node = 0, next;
+
+    if (!p->nodes_cnt && pattern_init(p) < 0)
+        return -1;
+
+    for (; *pattern; pattern++) {
+        if (*pattern == '*') {
+            /* Several stars in a row are just one. */
+            while (pattern[1] == '*')
+                pattern++;
+            if ((next = p->nodes[node].star) < 0) {
+                if ((next = new_node(p)) < 0)
+                    return -1;
+                p->nodes[next].loop = 1;
+                p->nodes[node].star = next;
+            }
+        } else if (*pattern == '?') {
+            if ((next = p->nodes[node].any) < 0) {
+                if ((next = new_node(p)) < 0)
+                    return -1;
+                p->nodes[node].any = next;
+            }
+        } else if ((next = edge(p, node, (unsigned char)*pattern)) < 0) {
+            return -1;
+        }
+        node = next;
+    }
+    p->nodes[node].accept = 1;
+    p->patterns++;
+
+    /* The states built so far don't know the new pattern. */
+    free_states(p);
+
+    return 0;
+}
+
+static int int_cmp(const void* a, const void* b) {
+    return *(const int*)a - *(const int*)b;
+}
+
+typedef struct node_set {
+    int* nodes;
+    int cnt;
+} node_set;
+
+static int state_eq(const void* value, const void* key) {
+    const pattern_state* s = value;
+    const node_set* set = key;
+
+    return s->nodes_cnt == set->cnt &&
+           memcmp(s->nodes, set->nodes, set->cnt * sizeof(int)) == 0;
+}
+
+/* Add the nodes reachable through `*' without consuming a character,
+ * then sort the set and drop duplicates.
+ */
+static void close_set(const pattern_set* p, node_set* set) {
+    int i, j;
+
+    for (i = 0; i < set->cnt; i++) {
+        int star = p->nodes[set->nodes[i]].star;
+        if (star >= 0)
+            set->nodes[set->cnt++] = star;
+    }
+
+    qsort(set->nodes, set->cnt, sizeof(int), int_cmp);
+    for (i = j = 0; i < set->cnt; i++)
+        if (!j || set->nodes[j - 1] != set->nodes[i])
+            set->nodes[j++] = set->nodes[i];
+    set->cnt = j;
+}
+
+/* Returns the state for set, creating it if needed. */
+static int get_state(pattern_set* p, const node_set* set) {
+    unsigned long long h = memhash(set->nodes, set->cnt * sizeof(int));
+    pattern_state *s, **states;
+    int i;
+
+    if (!set->cnt)
+        return STATE_DEAD;
+    if ((s = hash_find(&p->state_idx, h, state_eq, set)))
+        return s->id;
+
+    if (p->states_cnt == p->states_max) {
+        int max = p->states_max ? p->states_max * 2 : 16;
+
+        if (!(states = realloc(p->states, max * sizeof(pattern_state*))))
+            return STATE_NOMEM;
+        p->states = states;
+        p->states_max = max;
+    }
+
+    if (!(s = malloc(sizeof(pattern_state))))
+        return STATE_NOMEM;
+    if (!(s->nodes = malloc(set->cnt * sizeof(int)))) {
+        free(s);
+        return STATE_NOMEM;
+    }
+    s->id = p->states_cnt;
+    memcpy(s->nodes, set->nodes, set->cnt * sizeof(int));
+    s->nodes_cnt = set->cnt;
+    s->accept = 0;
+    for (i = 0; i < set->cnt; i++)
+        s->accept |= p->nodes[set->nodes[i]].accept;
+    for (i = 0; i < 256; i++)
+        s->next[i] = STATE_UNKNOWN;
+
+    if (hash_add(&p->state_idx, h, s) < 0) {
+        free(s->nodes);
+        free(s);
+        return STATE_NOMEM;
+    }
+    p->states[p->states_cnt++] = s;
+
+    return s->id;
+}
+
+static int step(pattern_set* p, int state, unsigned char c) {
+    const pattern_state* s = p->states[state];
+    node_set set;
+    int i, j, next;
+
+    /* Every node adds at most three: itself, an edge and `?', and the
+     * closure at most doubles that. */
+    if (!(set.nodes = malloc(s->nodes_cnt * 6 * sizeof(int))))
+        return STATE_NOMEM;
+    set.cnt = 0;
+
+    for (i = 0; i < s->nodes_cnt; i++) {
+        const pattern_node* n = &p->nodes[s->nodes[i]];
+
+        if (n->loop)
+            set.nodes[set.cnt++] = s->nodes[i];
+        if (n->any >= 0)
+            set.nodes[set.cnt++] = n->any;
+        for (j = 0; j < n->edges_cnt; j++) {
+            if (n->edges[j].c == c) {
+                set.nodes[set.cnt++] = n->edges[j].node;
+                break;
+            }
+        }
+    }
+    close_set(p, &set);
+
+    next = get_state(p, &set);
+    /* get_state() may have moved p->states, but not the states. */
+    if (next != STATE_NOMEM)
+        p->states[state]->next[c] = next;
+    free(set.nodes);
+
+    return next;
+}
+
+/* Returns 1 if name matches any of the patterns, and -1 if there is no
+ * memory to find out. */
+int pattern_match(pattern_set* p, const char* name) {
+    int state;
+
+    if (!p->patterns)
+        return 0;
+
+    if (!p->states_cnt) {
+        node_set set;
+
+        if (!(set.nodes = malloc(2 * sizeof(int))))
+            return -1;
+        set.nodes[0] = 0; /* the root */
+        set.cnt = 1;
+        close_set(p, &set);
+        state = get_state(p, &set);
+        free(set.nodes);
+        if (state == STATE_NOMEM)
+            return -1;
+    }
+
+    for (state = 0; *name; name++) {
+        unsigned char c = (unsigned char)*name;
+        int next = p->states[state]->next[c];
+
+        if (next == STATE_UNKNOWN)
+            next = step(p, state, c);
+        if (next == STATE_NOMEM)
+            return -1;
+        if (next == STATE_DEAD)
+            return 0;
+        state = next;
+    }
+
+    return p->states[state]->accept;
+}
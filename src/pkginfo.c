@@ -11,6 +11,7 @@
    "perfect" statusfile. If the status-file is corrupted it may
    result in deborphan giving the wrong packages, or even crashing. */
 
+#include <errno.h>
 #include <regex.h>
 #include <set.h>
 #include <stdlib.h>
@@ -19,52 +20,55 @@
 #include "config.h"
 #include "deborphan.h"
 
-static regex_t re_statusinst, re_statusnotinst, re_statushold, re_namedev,
-    re_gnugrepv, re_descdummy, re_desctransit, re_statusconfig, re_status;
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+void init_pkg_regex(context* ctx) {
+    pkg_regex* re = &ctx->re;
 
-void init_pkg_regex(void) {
-    regcomp(&re_statusinst, "^Status:.*[^-]installed$",
+    regcomp(&re->statusinst, "^Status:.*[^-]installed$",
             REG_EXTENDED | REG_FLAGS);
-    regcomp(&re_statusnotinst, "^Status:.*not\\-installed$",
+    regcomp(&re->statusnotinst, "^Status:.*not\\-installed$",
             REG_EXTENDED | REG_FLAGS);
-    regcomp(&re_statushold, "^Status:hold.*[^-]installed$",
+    regcomp(&re->statushold, "^Status:hold.*[^-]installed$",
             REG_EXTENDED | REG_FLAGS);
-    regcomp(&re_statusconfig, "^Status:.*config\\-files$",
+    regcomp(&re->statusconfig, "^Status:.*config\\-files$",
             REG_EXTENDED | REG_FLAGS);
-    regcomp(&re_status, "^Status:", REG_EXTENDED | REG_FLAGS);
+    regcomp(&re->status, "^Status:", REG_EXTENDED | REG_FLAGS);
 
-    if (options[GUESS]) {
+    if (ctx->options[GUESS]) {
         char guess[256];
         guess[0] = '\0';
 
-        if (guess_chk(GUESS_PERL))
+        if (guess_chk(ctx, GUESS_PERL))
             strcat(guess, "^lib.*-perl$|");
-        if (guess_chk(GUESS_PYTHON))
+        if (guess_chk(ctx, GUESS_PYTHON))
             strcat(guess, "^python[[:digit:].]*-|");
-        if (guess_chk(GUESS_PIKE))
+        if (guess_chk(ctx, GUESS_PIKE))
             strcat(guess, "^pike[[:digit:].]*-|");
-        if (guess_chk(GUESS_RUBY))
+        if (guess_chk(ctx, GUESS_RUBY))
             strcat(guess, "^lib.*-ruby[[:digit:].]*$|");
-        if (guess_chk(GUESS_MONO))
+        if (guess_chk(ctx, GUESS_MONO))
             strcat(guess, "^libmono|");
-        if (guess_chk(GUESS_DEV))
+        if (guess_chk(ctx, GUESS_DEV))
             strcat(guess, "-dev$|");
-        if (guess_chk(GUESS_DEBUG))
+        if (guess_chk(ctx, GUESS_DEBUG))
             strcat(guess, "-dbg(|sym)$|");
-        if (guess_chk(GUESS_COMMON))
+        if (guess_chk(ctx, GUESS_COMMON))
             strcat(guess, "-common$|");
-        if (guess_chk(GUESS_DATA))
+        if (guess_chk(ctx, GUESS_DATA))
             strcat(guess, "-(data|music)$|");
-        if (guess_chk(GUESS_DOC))
+        if (guess_chk(ctx, GUESS_DOC))
             strcat(guess, "-doc$|");
-        if (guess_chk(GUESS_KERNEL))
+        if (guess_chk(ctx, GUESS_KERNEL))
             strcat(guess,
                    "(-modules|^nvidia-kernel)-.*[[:digit:]]+\\.[[:digit:]]+\\."
                    "[[:digit:]]+");
-        if (guess_chk(GUESS_JAVA))
+        if (guess_chk(ctx, GUESS_JAVA))
             strcat(guess, "^lib.*-java$|");
-        if (guess_chk(GUESS_SECTION)) {
-            regcomp(&re_gnugrepv,
+        if (guess_chk(ctx, GUESS_SECTION)) {
+            regcomp(&re->gnugrepv,
                     "(-perl|-dev|-doc|-dbg)$|^lib(mono|pam|recad|reoffice)|-("
                     "ruby[[:"
                     "digit:]"
@@ -78,10 +82,10 @@ void init_pkg_regex(void) {
          * guess option is that we can combine it with --guess-only and
          * guess-all.
          */
-        if (guess_chk(GUESS_DUMMY)) {
-            regcomp(&re_descdummy, "^Description:.*dummy",
+        if (guess_chk(ctx, GUESS_DUMMY)) {
+            regcomp(&re->descdummy, "^Description:.*dummy",
                     REG_EXTENDED | REG_FLAGS);
-            regcomp(&re_desctransit,
+            regcomp(&re->desctransit,
                     "^Description:.*transition(|n)($|ing|al|ary| package| "
                     "purposes)",
                     REG_EXTENDED | REG_FLAGS);
@@ -89,32 +93,346 @@ void init_pkg_regex(void) {
         if (guess[strlen(guess) - 1] == '|')
             guess[strlen(guess) - 1] = '\0';
 
-        if (!guess_unique(GUESS_SECTION))
-            regcomp(&re_namedev, guess, REG_EXTENDED | REG_FLAGS);
+        if (!guess_unique(ctx, GUESS_SECTION))
+            regcomp(&re->namedev, guess, REG_EXTENDED | REG_FLAGS);
+    }
+}
+
+void free_pkg_regex(context* ctx) {
+    pkg_regex* re = &ctx->re;
+
+    regfree(&re->statusinst);
+    regfree(&re->statusnotinst);
+    regfree(&re->statushold);
+    regfree(&re->statusconfig);
+    regfree(&re->status);
+    regfree(&re->namedev);
+    regfree(&re->gnugrepv);
+    regfree(&re->descdummy);
+    regfree(&re->desctransit);
+}
+
+/* Cut the next stanza off the status file buffer *buf. The stanza is
+ * everything up to the next empty line, which is replaced by a '\0';
+ * *len is set to its length. Returns NULL when the buffer is used up.
+ */
+char* next_stanza(char** buf, size_t* len) {
+    char *s = *buf, *e;
+
+    if (!s || !*s)
+        return NULL;
+
+    if (*s == '\n') {
+        /* An empty line right away, i.e. an empty stanza. */
+        *s = '\0';
+        *buf = s + 1;
+        *len = 0;
+        return s;
+    }
+
+    for (e = s; (e = strchr(e, '\n')); e++) {
+        if (e[1] == '\n' || e[1] == '\0')
+            break;
+    }
+
+    if (e) {
+        *e = '\0';
+        *buf = e[1] ? e + 2 : e + 1;
+    } else {
+        e = s + strlen(s);
+        *buf = e;
+    }
+    *len = e - s;
+
+    return s;
+}
+
+/* Parse the lines of one stanza, as returned by next_stanza(), into
+ * package.
+ */
+void get_pkg_stanza(context* ctx,
+                    char* stanza,
+                    pkg_info* package,
+                    int* multiarch) {
+    char* line;
+
+    while ((line = strsep(&stanza, "\n")) != NULL) {
+        if ((!strchr("AIPpSsEeDdRr", *line)) || (*line == ' ') ||
+            (*line == '\0'))
+            continue;
+
+        strstripchr(line, ' ');
+        get_pkg_info(ctx, line, package, multiarch);
+    }
+}
+
+/* Parse stanza into this, the empty package ending the list, and keep it
+ * if it belongs in the list. Returns the package ending the list now.
+ */
+static pkg_info* add_stanza(context* ctx,
+                            char* stanza,
+                            pkg_info* this,
+                            int* multiarch) {
+    get_pkg_stanza(ctx, stanza, this, multiarch);
+
+    if (!this->install && !ctx->options[FIND_CONFIG]) {
+        reinit_pkg(this);
+        return this;
+    }
+    if (is_excluded(ctx, &this->self)) {
+        /* --explain-filter tells about them too; it checks nothing. */
+        if (!ctx->options[EXPLAIN_FILTER]) {
+            reinit_pkg(this);
+            return this;
+        }
+        this->excluded = 1;
+    }
+    if (ctx->options[AUTO_ONLY])
+        this->auto_installed = is_auto_installed(ctx, &this->self);
+    this->next = malloc(sizeof(pkg_info));
+    init_pkg(this->next);
+
+    return this->next;
+}
+
+/* Parse the stanzas in content into a list of packages, see
+ * read_status(). *last is set to the empty package ending the list.
+ */
+static pkg_info* read_stanzas(context* ctx,
+                              char* content,
+                              int* multiarch,
+                              pkg_info** last) {
+    pkg_info *package, *this;
+    char* stanza;
+    size_t len;
+
+    this = package = (pkg_info*)malloc(sizeof(pkg_info));
+    init_pkg(this);
+
+    while (!ctx->bad_status &&
+           (stanza = next_stanza(&content, &len)) != NULL)
+        this = add_stanza(ctx, stanza, this, multiarch);
+
+    this->next = NULL;
+    *last = this;
+
+    return package;
+}
+
+#ifdef HAVE_PTHREAD
+/* Parts of the status file smaller than this aren't worth a thread. */
+#define SHARD_MIN_SIZE (256 * 1024)
+
+/* regexec() locks a compiled expression while it runs, so every thread
+ * works with a copy of the context that has regular expressions of its
+ * own. It also has its own first architecture found.
+ */
+typedef struct shard {
+    pthread_t thread;
+    context ctx;
+    char* content;
+    pkg_info* first;
+    pkg_info* last;
+    int multiarch;
+} shard;
+
+/* Find the first stanza that starts at p or later and cut the empty
+ * line in front of it off the stanzas before, which start at start.
+ * Returns the stanza, or NULL if there is none.
+ */
+static char* split_stanzas(char* start, char* p) {
+    char* e;
+
+    if (p < start)
+        p = start;
+    while ((e = strstr(p, "\n\n"))) {
+        /* Only the first of several empty lines ends a stanza, the others
+         * are empty stanzas of their own. */
+        while (e > start && e[-1] == '\n')
+            e--;
+        if (e > start) {
+            e[1] = '\0';
+            return e + 2;
+        }
+        p = e + strspn(e, "\n");
+    }
+
+    return NULL;
+}
+
+static void* parse_shard(void* arg) {
+    shard* sh = arg;
+
+    init_pkg_regex(&sh->ctx);
+    sh->first = read_stanzas(&sh->ctx, sh->content, &sh->multiarch, &sh->last);
+    free_pkg_regex(&sh->ctx);
+
+    return NULL;
+}
+
+/* Split content into up to options[JOBS] parts at stanza boundaries and
+ * parse them in threads of their own. The lists are joined in the order
+ * of the parts, so the result is the same as parsing in one go.
+ */
+static pkg_info* read_status_parallel(context* ctx,
+                                      char* content,
+                                      int* multiarch) {
+    size_t len = strlen(content);
+    int cnt = ctx->options[JOBS], i, err;
+    pkg_info *package, *last;
+    shard* sh;
+
+    if ((size_t)cnt > len / SHARD_MIN_SIZE)
+        cnt = len / SHARD_MIN_SIZE;
+    if (cnt < 2)
+        return read_stanzas(ctx, content, multiarch, &last);
+
+    sh = calloc(cnt, sizeof(shard));
+    sh[0].content = content;
+    for (i = 1; i < cnt; i++) {
+        sh[i].content =
+            split_stanzas(sh[i - 1].content, content + len * i / cnt);
+        if (!sh[i].content)
+            break;
+    }
+    cnt = i;
+
+    for (i = 0; i < cnt; i++) {
+        sh[i].ctx = *ctx;
+        memset(&sh[i].ctx.re, 0, sizeof(pkg_regex));
+        sh[i].ctx.firstarch = NULL;
+        if ((err = pthread_create(&sh[i].thread, NULL, parse_shard, &sh[i])))
+            error(EXIT_FAILURE, err, "pthread_create");
+    }
+    for (i = 0; i < cnt; i++)
+        pthread_join(sh[i].thread, NULL);
+
+    for (i = 0; i < cnt; i++) {
+        /* Same as in get_pkg_info(). */
+        if (!*multiarch && sh[i].multiarch)
+            *multiarch = 1;
+        if (!*multiarch && sh[i].ctx.firstarch) {
+            if (!ctx->firstarch)
+                ctx->firstarch = strdup(sh[i].ctx.firstarch);
+            else if (strcmp(ctx->firstarch, sh[i].ctx.firstarch) != 0)
+                *multiarch = 1;
+        }
+        free(sh[i].ctx.firstarch);
+        /* The first problem in the file is the one reported. */
+        if (!ctx->bad_status)
+            ctx->bad_status = sh[i].ctx.bad_status;
+
+        if (i == 0)
+            continue;
+        /* Replace the empty package ending the list before by the first
+         * package of this one. */
+        *sh[i - 1].last = *sh[i].first;
+        if (sh[i].last == sh[i].first)
+            sh[i].last = sh[i - 1].last;
+        free(sh[i].first);
+    }
+    if (*multiarch) {
+        free(ctx->firstarch);
+        ctx->firstarch = NULL;
+    }
+
+    package = sh[0].first;
+    free(sh);
+
+    return package;
+}
+#endif /* HAVE_PTHREAD */
+
+/* Parse a whole status file into a list of packages. Only installed
+ * packages (or, with --find-config, all packages) that are not excluded
+ * make it into the list. The list is terminated by an empty package.
+ * If ctx->bad_status is set, parsing stopped early and the list must
+ * not be used.
+ */
+pkg_info* read_status(context* ctx, char* content, int* multiarch) {
+    pkg_info* last;
+
+    ctx->bad_status = STATUS_OK;
+
+#ifdef HAVE_PTHREAD
+    if (ctx->options[JOBS] > 1)
+        return read_status_parallel(ctx, content, multiarch);
+#endif
+
+    return read_stanzas(ctx, content, multiarch, &last);
+}
+
+/* Like read_status(), but reading sfile, or standard input if it is "-",
+ * as it goes, see reader.c. The file is never in memory as a whole,
+ * unless it has to be: when dpkg's journal is to be laid over it, and
+ * for -j, which splits it into parts up front. Returns NULL and sets
+ * errno if the file can't be read.
+ */
+pkg_info* read_status_file(context* ctx, const char* sfile, int* multiarch) {
+    pkg_info *package, *this;
+    stanza_reader* r;
+    char* stanza;
+    size_t len;
+    int err;
+
+    ctx->bad_status = STATUS_OK;
+    if (ctx->options[JOBS] > 1 || status_has_updates(sfile)) {
+        char* content = debopen_status(sfile);
+
+        if (!content)
+            return NULL;
+        package = read_status(ctx, content, multiarch);
+        free(content);
+        forget_file(ctx, sfile);
+        return package;
     }
+
+    if (!(r = reader_open(sfile, !ctx->options[LOW_IMPACT])))
+        return NULL;
+
+    this = package = (pkg_info*)malloc(sizeof(pkg_info));
+    init_pkg(this);
+
+    while (!ctx->bad_status && (stanza = reader_next(r, &len)) != NULL)
+        this = add_stanza(ctx, stanza, this, multiarch);
+    this->next = NULL;
+
+    err = reader_error(r);
+    reader_close(r);
+    if (err) {
+        free_pkg_list(package);
+        errno = err;
+        return NULL;
+    }
+    forget_file(ctx, sfile);
+
+    return package;
 }
 
-void free_pkg_regex(void) {
-    regfree(&re_statusinst);
-    regfree(&re_statusnotinst);
-    regfree(&re_statushold);
-    regfree(&re_statusconfig);
-    regfree(&re_status);
-    regfree(&re_namedev);
-    regfree(&re_gnugrepv);
-    regfree(&re_descdummy);
-    regfree(&re_desctransit);
+void free_pkg_list(pkg_info* package) {
+    pkg_info* next;
+
+    for (; package; package = next) {
+        next = package->next;
+        reinit_pkg(package);
+        free(package);
+    }
 }
 
 /* A similar "hack" was created by Paul Martin a while ago. It was not
  * implemented then for various reasons. This selects the function to
  * call to get the info, based on the first few characters.
  * Not as versatile as regular expressions, but it makes up for that in
- * speed.
+ * speed. A line that is no field sets ctx->bad_status.
  */
-void get_pkg_info(const char* line, pkg_info* package, int* multiarch) {
+void get_pkg_info(context* ctx,
+                  const char* line,
+                  pkg_info* package,
+                  int* multiarch) {
     if (strchr(line, ':') == 0) {
-        exit_invalid_statusfile();
+        if (!ctx->bad_status)
+            ctx->bad_status = STATUS_INVALID;
+        return;
     }
 
     switch (upcase(line[0])) {
@@ -140,7 +458,7 @@ void get_pkg_info(const char* line, pkg_info* package, int* multiarch) {
                     get_pkg_deps(line, package);
                     break;
                 case 'S': /* DeScription */
-                    get_pkg_dummy(line, package);
+                    get_pkg_dummy(ctx, line, package);
                     break;
             }
             break;
@@ -153,7 +471,7 @@ void get_pkg_info(const char* line, pkg_info* package, int* multiarch) {
         case 'R':
             switch (upcase(line[2])) {
                 case 'C': /* ReCommends */
-                    if (!options[IGNORE_RECOMMENDS])
+                    if (!ctx->options[IGNORE_RECOMMENDS])
                         get_pkg_deps(line, package);
                     break;
             }
@@ -164,10 +482,10 @@ void get_pkg_info(const char* line, pkg_info* package, int* multiarch) {
                     get_pkg_section(line, package);
                     break;
                 case 'T': /* STatus */
-                    get_pkg_status(line, package);
+                    get_pkg_status(ctx, line, package);
                     break;
                 case 'U': /* SUggests */
-                    if (!options[IGNORE_SUGGESTS])
+                    if (!ctx->options[IGNORE_SUGGESTS])
                         get_pkg_deps(line, package);
                     break;
             }
@@ -175,25 +493,24 @@ void get_pkg_info(const char* line, pkg_info* package, int* multiarch) {
         case 'A':
             if (strncmp("Architecture:", line, sizeof("Architecture:") - 1) ==
                 0) {
-                static char* firstarchfound = NULL;
                 /* Spaces are removed from the line, so the field's value starts
                  * directly after the colon. */
                 const char* arch = line + sizeof("Architecture:") - 1;
                 package->self.arch = strdup(arch);
                 if (*multiarch == 1 || strcmp(arch, "all") == 0)
                     break;
-                if (firstarchfound == NULL)
-                    firstarchfound = strdup(arch);
-                else if (strcmp(arch, firstarchfound) != 0) {
+                if (ctx->firstarch == NULL)
+                    ctx->firstarch = strdup(arch);
+                else if (strcmp(arch, ctx->firstarch) != 0) {
                     *multiarch = 1;
-                    /* The variable firstarchfound is only needed to detect if
+                    /* ctx->firstarch is only needed to detect if
                      * packages from multiple architectures are installed (we
                      * can't ask dpkg because the read status file might belong
                      * to a different system).  Now that we know that the status
                      * file contains multiple architectures we can free
-                     * firstarchfound.*/
-                    free(firstarchfound);
-                    firstarchfound = NULL;
+                     * ctx->firstarch.*/
+                    free(ctx->firstarch);
+                    ctx->firstarch = NULL;
                 }
             }
             break;
@@ -210,12 +527,12 @@ void get_pkg_installed_size(const char* line, pkg_info* package) {
         package->installed_size = strtol(line + 15, NULL, 10);
 }
 
-void get_pkg_dummy(const char* line, pkg_info* package) {
-    if (!guess_chk(GUESS_DUMMY))
+void get_pkg_dummy(context* ctx, const char* line, pkg_info* package) {
+    if (!guess_chk(ctx, GUESS_DUMMY))
         return;
 
-    if (regexec(&re_descdummy, line, 0, NULL, 0) == 0 ||
-        regexec(&re_desctransit, line, 0, NULL, 0) == 0) {
+    if (regexec(&ctx->re.descdummy, line, 0, NULL, 0) == 0 ||
+        regexec(&ctx->re.desctransit, line, 0, NULL, 0) == 0) {
         package->dummy = 1;
     }
 }
@@ -245,9 +562,11 @@ void get_pkg_deps(const char* line, pkg_info* package) {
             }
         }
 
-        if (dup)
+        if (dup) {
+            /* Packages outlive a run with --serve and libdeborphan. */
+            free(d.name);
             num_deps--;
-        else {
+        } else {
             if (num_deps >= package->deps_max) {
                 /* grow deps[] array */
                 package->deps_max = package->deps_max ? package->deps_max * 2
@@ -293,34 +612,36 @@ void get_pkg_name(const char* line, pkg_info* package) {
     package->self.namehash = strhash(name);
 }
 
-void get_pkg_status(const char* line, pkg_info* package) {
-    if (!regexec(&re_statusinst, line, 0, NULL, 0)) {
+void get_pkg_status(context* ctx, const char* line, pkg_info* package) {
+    pkg_regex* re = &ctx->re;
+
+    if (!regexec(&re->statusinst, line, 0, NULL, 0)) {
         set_install(package);
-        if (!options[FORCE_HOLD]) {
-            if (!regexec(&re_statushold, line, 0, NULL, 0))
+        if (!ctx->options[FORCE_HOLD]) {
+            if (!regexec(&re->statushold, line, 0, NULL, 0))
                 set_hold(package);
         }
-    } else if (!regexec(&re_statusconfig, line, 0, NULL, 0)) {
-        if (options[FIND_CONFIG])
+    } else if (!regexec(&re->statusconfig, line, 0, NULL, 0)) {
+        if (ctx->options[FIND_CONFIG])
             set_config(package);
-    } else if (regexec(&re_statusnotinst, line, 0, NULL, 0)) {
+    } else if (regexec(&re->statusnotinst, line, 0, NULL, 0)) {
         /* The package state is neither installed, config-files nor
          * not-installed.  It is also possible that get_pkg_info()
          * wrongly detected the current line as a status line.
          *
-         * Abort with error message "improper state" if we
-         * really parsed a status line.
+         * The status file is in an improper state if we really parsed
+         * a status line.
          */
-        if (!regexec(&re_status, line, 0, NULL, 0))
-            exit_improperstate();
+        if (!regexec(&re->status, line, 0, NULL, 0) && !ctx->bad_status)
+            ctx->bad_status = STATUS_IMPROPER;
     }
 }
 
 /* Okay, this function does not really check the libraryness of a package,
  * but it checks whether the package should be checked (1) or not (0).
  */
-unsigned int is_library(pkg_info* package, int search_libdevel) {
-    if (options[ALL_PACKAGES])
+unsigned int is_library(context* ctx, pkg_info* package, int search_libdevel) {
+    if (ctx->options[ALL_PACKAGES])
         return 1;
 
     if (!package->section)
@@ -334,10 +655,11 @@ unsigned int is_library(pkg_info* package, int search_libdevel) {
     /* Mono libraries must be handeled especially since Mono puts its
      * development libraries in section libs.
      */
-    if (!guess_chk(GUESS_MONO) && !strncmp(package->self.name, "libmono", 7))
+    if (!guess_chk(ctx, GUESS_MONO) &&
+        !strncmp(package->self.name, "libmono", 7))
         return 0;
 
-    if (!options[GUESS_ONLY]) {
+    if (!ctx->options[GUESS_ONLY]) {
         if (strstr(package->section, "/libs") ||
             strstr(package->section, "/oldlibs") ||
             strstr(package->section, "/introspection") ||
@@ -345,35 +667,35 @@ unsigned int is_library(pkg_info* package, int search_libdevel) {
             return 1;
     }
 
-    if (!options[GUESS])
+    if (!ctx->options[GUESS])
         return 0;
 
     /* See comments in init_pkg_regex(). */
-    if (guess_chk(GUESS_DUMMY) && package->dummy)
+    if (guess_chk(ctx, GUESS_DUMMY) && package->dummy)
         return 1;
 
     /* Avoid checking package name if we're only checking dummy,
      * which we get from the description line.
      */
-    if (guess_unique(GUESS_DUMMY))
+    if (guess_unique(ctx, GUESS_DUMMY))
         return 0;
 
     /* ^lib has been removed from re_namedev in deborphan 1.7.28, thus mark
      * this package as to be checked when re_namedev matches. When
      * GUESS_SECTION is set unique the regex always matches wrongly.
      */
-    if (!guess_unique(GUESS_SECTION))
-        if (!regexec(&re_namedev, package->self.name, 0, NULL, 0))
+    if (!guess_unique(ctx, GUESS_SECTION))
+        if (!regexec(&ctx->re.namedev, package->self.name, 0, NULL, 0))
             return 1;
 
-    if (!guess_chk(GUESS_SECTION))
+    if (!guess_chk(ctx, GUESS_SECTION))
         return 0;
 
     /* Check whether the package begins with lib, but not if it ends in one of:
      * -dbg, -dbgsym, -doc, -perl or -dev. This is what --guess-section does.
      */
     if (!strncmp(package->self.name, "lib", 3))
-        if (regexec(&re_gnugrepv, package->self.name, 0, NULL, 0))
+        if (regexec(&ctx->re.gnugrepv, package->self.name, 0, NULL, 0))
             return 1;
 
     return 0;
@@ -0,0 +1,600 @@
+/* reader.c - Reading the status file stanza by stanza for deborphan.
+
+   Distributed under the terms of the MIT License, see the
+   file COPYING provided in this package for details.
+*/
+
+/* A stanza reader reads a status file in chunks of READ_CHUNK bytes and
+ * hands out its stanzas as soon as they are complete, so the status
+ * file can come from a pipe, and the file is never in memory as a
+ * whole: a stanza that is cut by the end of a chunk is moved to the
+ * front of the buffer and completed by the next chunk, so the buffer is
+ * as large as the largest stanza and a chunk.
+ *
+ * With threads, the chunks are read by a thread of their own, up to
+ * READ_AHEAD chunks ahead of the stanzas handed out, so reading from a
+ * slow disk, network file system or pipe goes on while the stanzas read
+ * so far are parsed. --low-impact asks for a single thread, and then
+ * the chunks are read as they are needed.
+ *
+ * Status files compressed with gzip, xz or zstd are recognised by their
+ * first bytes and decompressed chunk by chunk as they are read, by the
+ * reading thread if there is one. Which of them can be read depends on
+ * the libraries found by configure.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "deborphan.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define READ_CHUNK (64 * 1024)
+#define READ_AHEAD 4
+
+enum { PLAIN, GZIP, XZ, ZSTD };
+
+static const struct {
+    const char* name;
+    const char* magic;
+    size_t len;
+} formats[] = {
+    {NULL, NULL, 0},
+    {"gzip", "\x1f\x8b", 2},
+    {"xz", "\xfd" "7zXZ\0", 6},
+    {"zstd", "\x28\xb5\x2f\xfd", 4},
+};
+
+#define MAGIC_MAX 6
+
+/* Where the chunks come from: the file itself, or a decompressor
+ * reading it.
+ */
+typedef struct source {
+    int fd;
+    int format;
+    char* in; /* compressed data, or what was read to find the format */
+    size_t in_len;
+    size_t in_pos;
+    int in_eof;
+    int frame_done; /* the input read so far ends with a whole frame */
+#ifdef HAVE_ZLIB
+    z_stream gz;
+#endif
+#ifdef HAVE_LZMA
+    lzma_stream xz;
+    int xz_end;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DStream* zs;
+#endif
+} source;
+
+struct stanza_reader {
+    source src;
+    char* buf;
+    size_t len;  /* of the data in buf */
+    size_t max;  /* the size of buf */
+    size_t pos;  /* where the next stanza starts */
+    size_t scan; /* where to go on looking for its end */
+    int eof;
+    int err; /* errno of a failed read */
+#ifdef HAVE_PTHREAD
+    int threaded; /* the chunks are read by a thread of their own */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;
+    pthread_cond_t emptied;
+    char* chunks; /* READ_AHEAD chunks, used as a ring */
+    size_t chunk_len[READ_AHEAD];
+    int head; /* the chunk to be taken next */
+    int cnt;  /* the number of chunks read and not taken yet */
+    int done; /* the thread has read everything, or failed */
+    int stop;
+    int read_err;
+#endif
+};
+
+static ssize_t read_fd(int fd, char* buf, size_t len) {
+    ssize_t n;
+
+    do
+        n = read(fd, buf, len);
+    while (n < 0 && errno == EINTR);
+
+    return n;
+}
+
+static int format_of(const char* buf, size_t len) {
+    int i;
+
+    for (i = PLAIN + 1; i < (int)(sizeof(formats) / sizeof(formats[0])); i++)
+        if (len >= formats[i].len &&
+            memcmp(buf, formats[i].magic, formats[i].len) == 0)
+            return i;
+
+    return PLAIN;
+}
+
+/* Read the next piece of compressed data, unless some is left. */
+static int fill_in(source* s) {
+    ssize_t n;
+
+    if (s->in_pos < s->in_len || s->in_eof)
+        return 0;
+    if ((n = read_fd(s->fd, s->in, READ_CHUNK)) < 0)
+        return -1;
+    s->in_len = n;
+    s->in_pos = 0;
+    s->in_eof = !n;
+
+    return 0;
+}
+
+/* The decoders decompress what is left of s->in into out, until either
+ * is used up, and set *produced. They return 1 if the input so far ends
+ * with a whole frame, 0 if not, and -1 if it is corrupt.
+ */
+#ifdef HAVE_ZLIB
+static int decode_gzip(source* s, char* out, size_t max, size_t* produced) {
+    int r;
+
+    s->gz.next_in = (unsigned char*)s->in + s->in_pos;
+    s->gz.avail_in = s->in_len - s->in_pos;
+    s->gz.next_out = (unsigned char*)out;
+    s->gz.avail_out = max;
+    r = inflate(&s->gz, Z_NO_FLUSH);
+    s->in_pos = s->in_len - s->gz.avail_in;
+    *produced = max - s->gz.avail_out;
+
+    if (r == Z_STREAM_END) {
+        /* Another member may follow, as with "cat a.gz b.gz". */
+        inflateReset(&s->gz);
+        return 1;
+    }
+
+    return r == Z_OK || r == Z_BUF_ERROR ? 0 : -1;
+}
+#endif
+
+#ifdef HAVE_LZMA
+static int decode_xz(source* s, char* out, size_t max, size_t* produced) {
+    lzma_ret r;
+
+    *produced = 0;
+    if (s->xz_end)
+        return 1;
+    s->xz.next_in = (uint8_t*)s->in + s->in_pos;
+    s->xz.avail_in = s->in_len - s->in_pos;
+    s->xz.next_out = (uint8_t*)out;
+    s->xz.avail_out = max;
+    r = lzma_code(&s->xz, s->in_eof ? LZMA_FINISH : LZMA_RUN);
+    s->in_pos = s->in_len - s->xz.avail_in;
+    *produced = max - s->xz.avail_out;
+
+    /* With LZMA_CONCATENATED, the end is only known at LZMA_FINISH. */
+    if (r == LZMA_STREAM_END)
+        return s->xz_end = 1;
+
+    return r == LZMA_OK || r == LZMA_BUF_ERROR ? 0 : -1;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static int decode_zstd(source* s, char* out, size_t max, size_t* produced) {
+    ZSTD_inBuffer in = {s->in, s->in_len, s->in_pos};
+    ZSTD_outBuffer o = {out, max, 0};
+    size_t r = ZSTD_decompressStream(s->zs, &o, &in);
+
+    s->in_pos = in.pos;
+    *produced = o.pos;
+    if (ZSTD_isError(r))
+        return -1;
+
+    return r == 0;
+}
+#endif
+
+static int decode(source* s, char* out, size_t max, size_t* produced) {
+    switch (s->format) {
+#ifdef HAVE_ZLIB
+        case GZIP:
+            return decode_gzip(s, out, max, produced);
+#endif
+#ifdef HAVE_LZMA
+        case XZ:
+            return decode_xz(s, out, max, produced);
+#endif
+#ifdef HAVE_ZSTD
+        case ZSTD:
+            return decode_zstd(s, out, max, produced);
+#endif
+    }
+    /* Without any of the libraries, source_open() has already failed. */
+    (void)out;
+    (void)max;
+    (void)produced;
+
+    return -1;
+}
+
+/* Read up to READ_CHUNK bytes of the status file into buf. Returns 0 at
+ * its end, or -1 on failure.
+ */
+static ssize_t source_read(source* s, char* buf) {
+    size_t len = 0, n, before;
+    int r;
+
+    if (s->format == PLAIN) {
+        if (s->in_pos == s->in_len)
+            return s->in_eof ? 0 : read_fd(s->fd, buf, READ_CHUNK);
+        len = s->in_len - s->in_pos;
+        memcpy(buf, s->in + s->in_pos, len);
+        s->in_pos = s->in_len;
+        return len;
+    }
+
+    while (len < READ_CHUNK) {
+        if (fill_in(s) < 0)
+            return -1;
+        before = s->in_pos;
+        if ((r = decode(s, buf + len, READ_CHUNK - len, &n)) < 0) {
+            errno = EBADMSG;
+            return -1;
+        }
+        len += n;
+        if (r || n || s->in_pos != before)
+            s->frame_done = r;
+        if (!n && s->in_pos == s->in_len && s->in_eof) {
+            if (!s->frame_done) {
+                /* Cut off in the middle of a frame. */
+                errno = EBADMSG;
+                return -1;
+            }
+            break;
+        }
+    }
+
+    return len;
+}
+
+/* Find out how fd is compressed and get ready to read it. Exits if it is
+ * compressed in a way this build can't read.
+ */
+static int source_open(source* s, int fd, const char* filename) {
+    ssize_t n;
+
+    memset(s, 0, sizeof(source));
+    s->fd = fd;
+    if (!(s->in = malloc(READ_CHUNK)))
+        error(EXIT_FAILURE, errno, "reader");
+
+    /* A pipe may hand out less than the longest magic at first. */
+    while (s->in_len < MAGIC_MAX && !s->in_eof) {
+        if ((n = read_fd(fd, s->in + s->in_len, READ_CHUNK - s->in_len)) < 0)
+            return -1;
+        s->in_len += n;
+        s->in_eof = !n;
+    }
+
+    switch ((s->format = format_of(s->in, s->in_len))) {
+        case PLAIN:
+            return 0;
+#ifdef HAVE_ZLIB
+        case GZIP:
+            /* 16 for the gzip header. */
+            if (inflateInit2(&s->gz, 15 + 16) != Z_OK)
+                error(EXIT_FAILURE, ENOMEM, "zlib");
+            return 0;
+#endif
+#ifdef HAVE_LZMA
+        case XZ:
+            if (lzma_stream_decoder(&s->xz, UINT64_MAX, LZMA_CONCATENATED) !=
+                LZMA_OK)
+                error(EXIT_FAILURE, ENOMEM, "lzma");
+            return 0;
+#endif
+#ifdef HAVE_ZSTD
+        case ZSTD:
+            if (!(s->zs = ZSTD_createDStream()))
+                error(EXIT_FAILURE, ENOMEM, "zstd");
+            ZSTD_initDStream(s->zs);
+            return 0;
+#endif
+    }
+
+    error(EXIT_FAILURE, 0, "%s: support for %s is not built in.", filename,
+          formats[s->format].name);
+}
+
+static void source_close(source* s) {
+    switch (s->format) {
+#ifdef HAVE_ZLIB
+        case GZIP:
+            inflateEnd(&s->gz);
+            break;
+#endif
+#ifdef HAVE_LZMA
+        case XZ:
+            lzma_end(&s->xz);
+            break;
+#endif
+#ifdef HAVE_ZSTD
+        case ZSTD:
+            ZSTD_freeDStream(s->zs);
+            break;
+#endif
+    }
+    free(s->in);
+}
+
+/* Returns 1 if buf, the first len bytes of a file, is compressed. */
+int is_compressed(const char* buf, size_t len) {
+    return format_of(buf, len) != PLAIN;
+}
+
+/* Read fd to its end, for files whose size is not known up front, such
+ * as pipes, and compressed files. filename is for error messages.
+ */
+char* debread(int fd, const char* filename) {
+    size_t len = 0, max = 2 * READ_CHUNK;
+    char *buf, *more;
+    source src;
+    ssize_t n;
+
+    if (source_open(&src, fd, filename) < 0 || !(buf = malloc(max))) {
+        source_close(&src);
+        return NULL;
+    }
+
+    for (;;) {
+        if (len + READ_CHUNK + 1 > max) {
+            if (!(more = realloc(buf, max * 2)))
+                break;
+            buf = more;
+            max *= 2;
+        }
+        if ((n = source_read(&src, buf + len)) <= 0) {
+            if (n < 0)
+                break;
+            buf[len] = '\0';
+            source_close(&src);
+            return buf;
+        }
+        len += n;
+    }
+
+    free(buf);
+    source_close(&src);
+    return NULL;
+}
+
+#ifdef HAVE_PTHREAD
+static void* read_ahead(void* arg) {
+    stanza_reader* r = arg;
+    ssize_t n;
+    int slot, stop;
+
+    for (;;) {
+        pthread_mutex_lock(&r->lock);
+        while (r->cnt == READ_AHEAD && !r->stop)
+            pthread_cond_wait(&r->emptied, &r->lock);
+        slot = (r->head + r->cnt) % READ_AHEAD;
+        stop = r->stop;
+        pthread_mutex_unlock(&r->lock);
+        if (stop)
+            break;
+
+        /* The slot is not the consumer's until cnt counts it. */
+        n = source_read(&r->src, r->chunks + (size_t)slot * READ_CHUNK);
+
+        pthread_mutex_lock(&r->lock);
+        if (n > 0) {
+            r->chunk_len[slot] = n;
+            r->cnt++;
+        } else {
+            r->read_err = n < 0 ? errno : 0;
+            r->done = 1;
+        }
+        pthread_cond_signal(&r->filled);
+        pthread_mutex_unlock(&r->lock);
+        if (n <= 0)
+            break;
+    }
+
+    return NULL;
+}
+#endif
+
+/* Append the next chunk to r->buf, or set r->eof. */
+static void fill(stanza_reader* r) {
+    ssize_t n;
+
+    if (r->len + READ_CHUNK + 1 > r->max) {
+        while (r->len + READ_CHUNK + 1 > r->max)
+            r->max *= 2;
+        if (!(r->buf = realloc(r->buf, r->max)))
+            error(EXIT_FAILURE, errno, "reader");
+    }
+
+#ifdef HAVE_PTHREAD
+    if (r->threaded) {
+        pthread_mutex_lock(&r->lock);
+        while (!r->cnt && !r->done)
+            pthread_cond_wait(&r->filled, &r->lock);
+        if (!r->cnt) {
+            r->err = r->read_err;
+            r->eof = 1;
+            pthread_mutex_unlock(&r->lock);
+            return;
+        }
+        n = r->chunk_len[r->head];
+        pthread_mutex_unlock(&r->lock);
+
+        memcpy(r->buf + r->len, r->chunks + (size_t)r->head * READ_CHUNK, n);
+
+        pthread_mutex_lock(&r->lock);
+        r->head = (r->head + 1) % READ_AHEAD;
+        r->cnt--;
+        pthread_cond_signal(&r->emptied);
+        pthread_mutex_unlock(&r->lock);
+
+        r->len += n;
+        return;
+    }
+#endif
+
+    if ((n = source_read(&r->src, r->buf + r->len)) <= 0) {
+        r->err = n < 0 ? errno : 0;
+        r->eof = 1;
+        return;
+    }
+
+    r->len += n;
+}
+
+/* Open filename, or standard input if it is "-", for reader_next(). Unless
+ * threaded is 0, it is read ahead by a thread. Returns NULL if it can't
+ * be opened.
+ */
+stanza_reader* reader_open(const char* filename, int threaded) {
+    stanza_reader* r;
+    int fd, err;
+
+    if (strcmp(filename, "-") == 0)
+        fd = STDIN_FILENO;
+    else if ((fd = open(filename, O_RDONLY)) < 0)
+        return NULL;
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    if (!(r = calloc(1, sizeof(stanza_reader))))
+        error(EXIT_FAILURE, errno, "reader");
+    if (source_open(&r->src, fd, filename) < 0) {
+        err = errno;
+        source_close(&r->src);
+        if (fd != STDIN_FILENO)
+            close(fd);
+        free(r);
+        errno = err;
+        return NULL;
+    }
+    r->max = 2 * READ_CHUNK;
+    if (!(r->buf = malloc(r->max)))
+        error(EXIT_FAILURE, errno, "reader");
+
+#ifdef HAVE_PTHREAD
+    if ((r->threaded = threaded)) {
+        if (!(r->chunks = malloc((size_t)READ_AHEAD * READ_CHUNK)))
+            error(EXIT_FAILURE, errno, "reader");
+        pthread_mutex_init(&r->lock, NULL);
+        pthread_cond_init(&r->filled, NULL);
+        pthread_cond_init(&r->emptied, NULL);
+        if ((err = pthread_create(&r->thread, NULL, read_ahead, r)))
+            error(EXIT_FAILURE, err, "pthread_create");
+    }
+#else
+    (void)threaded;
+#endif
+
+    return r;
+}
+
+/* The next stanza, cut up as next_stanza() does: everything up to the
+ * next empty line, '\0' terminated, with *len set to its length. It is
+ * valid until the next call. Returns NULL at the end of the file, or if
+ * it can't be read, see reader_error().
+ */
+char* reader_next(stanza_reader* r, size_t* len) {
+    char *s, *e, *end;
+
+    for (;;) {
+        s = r->buf + r->pos;
+        end = r->buf + r->len;
+
+        if (s < end && *s == '\n') {
+            /* An empty line right away, i.e. an empty stanza. */
+            *s = '\0';
+            r->scan = ++r->pos;
+            *len = 0;
+            return s;
+        }
+
+        for (e = r->buf + r->scan; e < end && (e = memchr(e, '\n', end - e));
+             e++)
+            if (e + 1 == end || e[1] == '\n')
+                break;
+
+        if (e && e + 1 < end) {
+            *e = '\0';
+            r->pos = r->scan = e + 2 - r->buf;
+            *len = e - s;
+            return s;
+        }
+        if (r->eof) {
+            if (s == end)
+                return NULL;
+            /* The last stanza, with or without a final newline. */
+            if (e && e < end)
+                end = e;
+            *end = '\0';
+            r->pos = r->scan = r->len;
+            *len = end - s;
+            return s;
+        }
+
+        /* Look at the newline at the end again, once it is followed by
+         * something. */
+        r->scan = e && e < end ? (size_t)(e - r->buf) : r->len;
+        if (r->pos) {
+            memmove(r->buf, s, r->len - r->pos);
+            r->len -= r->pos;
+            r->scan -= r->pos;
+            r->pos = 0;
+        }
+        fill(r);
+    }
+}
+
+/* The errno of a failed read, or 0 if the file was read to the end. */
+int reader_error(const stanza_reader* r) {
+    return r->err;
+}
+
+void reader_close(stanza_reader* r) {
+#ifdef HAVE_PTHREAD
+    if (r->threaded) {
+        pthread_mutex_lock(&r->lock);
+        r->stop = 1;
+        pthread_cond_signal(&r->emptied);
+        pthread_mutex_unlock(&r->lock);
+        pthread_join(r->thread, NULL);
+        pthread_cond_destroy(&r->filled);
+        pthread_cond_destroy(&r->emptied);
+        pthread_mutex_destroy(&r->lock);
+        free(r->chunks);
+    }
+#endif
+    source_close(&r->src);
+    if (r->src.fd != STDIN_FILENO)
+        close(r->src.fd);
+    free(r->buf);
+    free(r);
+}
@@ -0,0 +1,249 @@
+/* roots.c - Analysing many root filesystems at once for deborphan.
+
+   Distributed under the terms of the MIT License, see the
+   file COPYING provided in this package for details.
+*/
+
+/* With --root, every root is analysed on its own, with the status file,
+ * keep file and extended_states below it and the options given on the
+ * command line. All status files are announced to the kernel up front,
+ * so they are read ahead in parallel while the first roots are
+ * analysed. The roots are then handed out to -j threads, the largest
+ * first: a thread takes the next root whenever it is done with one, so
+ * a few huge roots don't leave the other threads idle at the end. Each
+ * root is printed to a buffer of its own, and the buffers are printed
+ * in the order the roots were given.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "deborphan.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+/* The files of a root, relative to it. */
+#define ROOT_STATUS_FILE "/var/lib/dpkg/status"
+#define ROOT_KEEPER_FILE "/var/lib/deborphan/keep"
+#define ROOT_EXTENDED_STATES_FILE "/var/lib/apt/extended_states"
+
+typedef struct root_job {
+    const char* dir;
+    off_t size; /* of the status file */
+    out_chunk out;
+    int failed;
+} root_job;
+
+typedef struct roots_pool {
+    context* ctx;
+    root_job* jobs;
+    root_job** order; /* largest first */
+    int cnt;
+    int next;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t lock;
+#endif
+} roots_pool;
+
+static char* root_path(const char* dir, const char* file) {
+    char* path = malloc(strlen(dir) + strlen(file) + 1);
+
+    if (!path)
+        error(EXIT_FAILURE, errno, "root");
+    strcpy(path, dir);
+    strcat(path, file);
+
+    return path;
+}
+
+/* Ask the kernel to start reading the status file, and note its size.
+ * With --low-impact, the files are only read when their turn comes. */
+static void prefetch(const context* ctx, root_job* job) {
+    char* path = root_path(job->dir, ROOT_STATUS_FILE);
+    struct stat st;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) >= 0) {
+        if (fstat(fd, &st) == 0)
+            job->size = st.st_size;
+#ifdef POSIX_FADV_WILLNEED
+        if (!ctx->options[LOW_IMPACT])
+            posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+        close(fd);
+    }
+    free(path);
+}
+
+static int size_cmp(const void* a, const void* b) {
+    off_t sa = (*(root_job* const*)a)->size;
+    off_t sb = (*(root_job* const*)b)->size;
+
+    return sa < sb ? 1 : sa > sb ? -1 : 0;
+}
+
+/* Analyse one root into job->out. Errors are reported right away. */
+static void analyse_root(const context* ctx, root_job* job) {
+    char *path, *content;
+    pkg_info* package;
+    context rc;
+    int multiarch = 0, print_suffix;
+
+    /* The excludes are shared, as they are only read. */
+    rc = *ctx;
+    memset(&rc.keep, 0, sizeof(rc.keep));
+    memset(&rc.search_for, 0, sizeof(rc.search_for));
+    memset(&rc.auto_set, 0, sizeof(rc.auto_set));
+    memset(&rc.re, 0, sizeof(rc.re));
+    rc.states_file = NULL;
+    rc.firstarch = NULL;
+    rc.options[JOBS] = 1;
+    rc.root = job->dir;
+
+    keep_init(&rc.keep);
+    path = root_path(job->dir, ROOT_KEEPER_FILE);
+    readkeep(&rc.keep, path);
+    free(path);
+#ifdef DEBFOSTER_KEEP
+    if (!rc.options[NO_DEBFOSTER]) {
+        path = root_path(job->dir, DEBFOSTER_KEEP);
+        readkeep(&rc.keep, path);
+        free(path);
+    }
+#endif
+
+    if (rc.options[AUTO_ONLY]) {
+        path = root_path(job->dir, ROOT_EXTENDED_STATES_FILE);
+        if (read_extended_states(&rc, path) < 0) {
+            fprintf(stderr, "%s: %s: %s\n", program_name, path,
+                    strerror(errno));
+            job->failed = 1;
+        }
+        free(path);
+    }
+
+    path = root_path(job->dir, ROOT_STATUS_FILE);
+    /* Without its marks, the root would seem to have no orphans. */
+    if (job->failed) {
+        content = NULL;
+    } else if (!(content = debopen_status(path))) {
+        fprintf(stderr, "%s: %s: %s\n", program_name, path, strerror(errno));
+        job->failed = 1;
+    }
+    forget_file(&rc, path);
+
+    if (content) {
+        init_pkg_regex(&rc);
+        package = read_status(&rc, content, &multiarch);
+        free(content);
+
+        if (rc.bad_status) {
+            fprintf(stderr, "%s: %s: %s\n", program_name, path,
+                    bad_status_message(rc.bad_status));
+            job->failed = 1;
+        } else {
+            print_suffix = (rc.options[SHOW_ARCH] == ALWAYS ||
+                            (rc.options[SHOW_ARCH] == DEFAULT && multiarch));
+            out_capture(&job->out);
+            check_orphans(&rc, package, print_suffix);
+            out_capture(NULL);
+        }
+
+        free_pkg_list(package);
+        free_pkg_regex(&rc);
+    }
+    free(path);
+
+    keep_free(&rc.keep);
+    free_extended_states(&rc);
+    free(rc.firstarch);
+}
+
+static void* analyse_roots(void* arg) {
+    roots_pool* pool = arg;
+    int i;
+
+    for (;;) {
+#ifdef HAVE_PTHREAD
+        pthread_mutex_lock(&pool->lock);
+#endif
+        i = pool->next++;
+#ifdef HAVE_PTHREAD
+        pthread_mutex_unlock(&pool->lock);
+#endif
+        if (i >= pool->cnt)
+            break;
+        analyse_root(pool->ctx, pool->order[i]);
+    }
+
+    return NULL;
+}
+
+/* Analyse the cnt roots and print what was found. Returns the number of
+ * roots that could not be analysed.
+ */
+int run_roots(context* ctx, char** roots, int cnt) {
+    roots_pool pool;
+    int i, failed = 0;
+#ifdef HAVE_PTHREAD
+    pthread_t* threads;
+    int nthreads, err;
+#endif
+
+    memset(&pool, 0, sizeof(pool));
+    pool.ctx = ctx;
+    pool.cnt = cnt;
+    pool.jobs = calloc(cnt + 1, sizeof(root_job));
+    pool.order = malloc((cnt + 1) * sizeof(root_job*));
+    if (!pool.jobs || !pool.order)
+        error(EXIT_FAILURE, errno, "root");
+
+    for (i = 0; i < cnt; i++) {
+        pool.jobs[i].dir = roots[i];
+        pool.order[i] = &pool.jobs[i];
+        prefetch(ctx, &pool.jobs[i]);
+    }
+    qsort(pool.order, cnt, sizeof(root_job*), size_cmp);
+
+    /* Everything shared by the threads has to be in place first. */
+    print_header(ctx);
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_init(&pool.lock, NULL);
+    /* This thread is one of them. */
+    nthreads = ctx->options[JOBS] > 1 ? ctx->options[JOBS] - 1 : 0;
+    if (nthreads > cnt - 1)
+        nthreads = cnt > 0 ? cnt - 1 : 0;
+    threads = malloc((nthreads + 1) * sizeof(pthread_t));
+    for (i = 0; i < nthreads; i++) {
+        if ((err = pthread_create(&threads[i], NULL, analyse_roots, &pool)))
+            error(EXIT_FAILURE, err, "pthread_create");
+    }
+    analyse_roots(&pool);
+    for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&pool.lock);
+    free(threads);
+#else
+    analyse_roots(&pool);
+#endif
+
+    for (i = 0; i < cnt; i++) {
+        out_release(&pool.jobs[i].out);
+        failed += pool.jobs[i].failed;
+    }
+    print_done(ctx);
+
+    free(pool.order);
+    free(pool.jobs);
+
+    return failed;
+}
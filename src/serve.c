@@ -0,0 +1,949 @@
+/* serve.c - Answer queries about the orphans over a socket.
+
+   Distributed under the terms of the MIT License, see the
+   file COPYING provided in this package for details.
+*/
+
+/* With --serve, deborphan loads the status file once, keeps it up to
+ * date like --watch does and answers requests on a Unix domain socket.
+ * All clients are served from a single epoll loop.
+ *
+ * A request is a line of words:
+ *
+ *   orphans               list the orphans
+ *   show-deps PKG...      list the packages depending on PKG
+ *   why PKG...            tell why PKG is or is not reported
+ *   what-if PKG...        list the packages that would become orphans
+ *                         if PKG were removed
+ *   keep list             list the kept packages
+ *   keep add|del PKG...   add to or remove from the keep file
+ *   reload                read the status file again
+ *
+ * The answer is a number of lines, terminated by an empty line; an
+ * error is a line starting with "error: " instead. A request can also be a
+ * JSON object such as {"cmd": "why", "args": ["libfoo"]}, which is
+ * answered by a single line {"ok": true, "result": ...}.
+ *
+ * A status file that can't be used, e.g. while dpkg has packages
+ * unpacked, doesn't replace the last good one, but until it is read
+ * again and is good, every request but reload is answered by an error.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cache.h>
+
+#include "config.h"
+#include "deborphan.h"
+
+/* Requests longer than this are refused. */
+#define MAX_REQUEST (64 * 1024)
+#define MAX_ARGS 1024
+#define MAX_EVENTS 64
+
+typedef struct client {
+    int fd;
+    int events; /* what it is registered for with epoll */
+    int eof;
+    int json;
+    int items; /* list items written so far */
+    char* in;
+    size_t inlen, inmax;
+    char* out;
+    size_t outlen, outmax, outoff;
+} client;
+
+/* The packages taking part in the analysis, looked up by name. */
+typedef struct rec_list {
+    char* name;
+    stanza_rec** recs;
+    size_t cnt, max;
+} rec_list;
+
+typedef struct server {
+    context* ctx;
+    const char* sfile;
+    const char* kfile;
+    const char* cfile;
+    snapshot snap;
+    hashtable byname;     /* package name -> recs */
+    hashtable providers;  /* name -> recs having or providing it */
+    hashtable dependents; /* name -> recs depending on it */
+    int print_suffix;
+    int broken;     /* errno of the last failed update, or 0 */
+    int bad_status; /* context.bad_status if broken is EBADMSG */
+} server;
+
+static int listen_tag, notify_tag;
+
+static int rec_list_eq(const void* value, const void* key) {
+    return strcmp(((const rec_list*)value)->name, (const char*)key) == 0;
+}
+
+static rec_list* rec_list_find(const hashtable* t, const char* name) {
+    return hash_find(t, memhash(name, strlen(name)), rec_list_eq, name);
+}
+
+static void rec_list_add(hashtable* t, const char* name, stanza_rec* rec) {
+    unsigned long long h = memhash(name, strlen(name));
+    rec_list* l = hash_find(t, h, rec_list_eq, name);
+
+    if (!l) {
+        l = calloc(1, sizeof(rec_list));
+        l->name = strdup(name);
+        hash_add(t, h, l);
+    }
+    if (l->cnt && l->recs[l->cnt - 1] == rec)
+        return;
+    if (l->cnt >= l->max) {
+        l->max = l->max ? l->max * 2 : 4;
+        l->recs = realloc(l->recs, l->max * sizeof(stanza_rec*));
+    }
+    l->recs[l->cnt++] = rec;
+}
+
+static void rec_lists_free(hashtable* t) {
+    size_t i;
+
+    for (i = 0; t->slots && i <= t->mask; i++) {
+        rec_list* l = t->slots[i].value;
+        if (l) {
+            free(l->name);
+            free(l->recs);
+            free(l);
+        }
+    }
+    hash_free(t);
+}
+
+static void index_snapshot(server* sv) {
+    stanza_rec* rec;
+    int i;
+
+    rec_lists_free(&sv->byname);
+    rec_lists_free(&sv->providers);
+    rec_lists_free(&sv->dependents);
+    hash_init(&sv->byname, 0);
+    hash_init(&sv->providers, 0);
+    hash_init(&sv->dependents, 0);
+
+    for (rec = sv->snap.recs; rec; rec = rec->next) {
+        pkg_info* p = &rec->pkg;
+
+        if (!rec->inlist || !p->self.name)
+            continue;
+        rec_list_add(&sv->byname, p->self.name, rec);
+        rec_list_add(&sv->providers, p->self.name, rec);
+        for (i = 0; i < p->provides_cnt; i++)
+            rec_list_add(&sv->providers, p->provides[i].name, rec);
+        for (i = 0; i < p->deps_cnt; i++)
+            rec_list_add(&sv->dependents, p->deps[i].name, rec);
+    }
+
+    sv->print_suffix =
+        (sv->ctx->options[SHOW_ARCH] == ALWAYS ||
+         (sv->ctx->options[SHOW_ARCH] == DEFAULT && sv->snap.multiarch));
+}
+
+/* Why the status file read last is not used. */
+static const char* load_error(const server* sv) {
+    if (sv->broken == EBADMSG)
+        return bad_status_message(sv->bad_status);
+    return strerror(sv->broken);
+}
+
+static int load(server* sv) {
+    char* content;
+    int rv;
+
+    if (!(content = debopen_status(sv->sfile))) {
+        fprintf(stderr, "%s: %s: %s\n", program_name, sv->sfile,
+                strerror(errno));
+        return -1;
+    }
+    if (sv->ctx->options[AUTO_ONLY] && read_extended_states(sv->ctx, NULL) < 0)
+        fprintf(stderr, "%s: extended_states: %s\n", program_name,
+                strerror(errno));
+    rv = snapshot_update(&sv->snap, content);
+    sv->broken = rv < 0 ? errno : 0;
+    sv->bad_status = sv->ctx->bad_status;
+    free(content);
+    /* Running out of memory may have emptied the snapshot. */
+    index_snapshot(sv);
+    if (rv < 0) {
+        fprintf(stderr, "%s: %s: %s, requests fail until it is good again\n",
+                program_name, sv->sfile, load_error(sv));
+        errno = sv->broken;
+        return -1;
+    }
+
+    if (sv->cfile && snapshot_save(&sv->snap, sv->cfile) < 0)
+        fprintf(stderr, "%s: %s: %s\n", program_name, sv->cfile,
+                strerror(errno));
+
+    return 0;
+}
+
+/* Output */
+
+static void out(client* c, const char* s, size_t len) {
+    if (!len)
+        return;
+    if (c->outlen + len > c->outmax) {
+        while (c->outlen + len > c->outmax)
+            c->outmax = c->outmax ? c->outmax * 2 : 4096;
+        c->out = realloc(c->out, c->outmax);
+    }
+    memcpy(c->out + c->outlen, s, len);
+    c->outlen += len;
+}
+
+static void outs(client* c, const char* s) {
+    out(c, s, strlen(s));
+}
+
+static void out_json_str(client* c, const char* s) {
+    char esc[8];
+
+    outs(c, "\"");
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            esc[0] = '\\';
+            esc[1] = *s;
+            out(c, esc, 2);
+        } else if ((unsigned char)*s < 0x20) {
+            snprintf(esc, sizeof(esc), "\\u%04x", *s);
+            outs(c, esc);
+        } else
+            out(c, s, 1);
+    }
+    outs(c, "\"");
+}
+
+static void begin_reply(client* c) {
+    if (c->json)
+        outs(c, "{\"ok\": true, \"result\": ");
+}
+
+static void end_reply(client* c) {
+    outs(c, c->json ? "}\n" : "\n");
+}
+
+static void reply_error(client* c, const char* fmt, ...) {
+    char msg[512];
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+
+    if (c->json) {
+        outs(c, "{\"ok\": false, \"error\": ");
+        out_json_str(c, msg);
+        outs(c, "}\n");
+    } else {
+        outs(c, "error: ");
+        outs(c, msg);
+        outs(c, "\n\n");
+    }
+}
+
+static void begin_list(client* c) {
+    c->items = 0;
+    if (c->json)
+        outs(c, "[");
+}
+
+static void end_list(client* c) {
+    if (c->json)
+        outs(c, "]");
+}
+
+/* A list item, indented by indent in text mode. */
+static void list_item(client* c, const char* s, const char* indent) {
+    if (c->json) {
+        if (c->items)
+            outs(c, ", ");
+        out_json_str(c, s);
+    } else {
+        outs(c, indent);
+        outs(c, s);
+        outs(c, "\n");
+    }
+    c->items++;
+}
+
+static const char* display_name(const server* sv, const pkg_info* p) {
+    static char buf[512];
+
+    if (!sv->print_suffix || !p->self.arch)
+        return p->self.name;
+    snprintf(buf, sizeof(buf), "%s:%s", p->self.name, p->self.arch);
+    return buf;
+}
+
+static void list_pkg(const server* sv,
+                     client* c,
+                     const pkg_info* p,
+                     const char* indent) {
+    list_item(c, display_name(sv, p), indent);
+}
+
+/* Find the packages called name, or name:arch. */
+static size_t lookup(const server* sv,
+                     char* name,
+                     stanza_rec** found,
+                     size_t max) {
+    char* arch = strchr(name, ':');
+    rec_list* l;
+    size_t i, n = 0;
+
+    if (arch)
+        *arch++ = '\0';
+    if (!(l = rec_list_find(&sv->byname, name)))
+        return 0;
+
+    for (i = 0; i < l->cnt && n < max; i++) {
+        const char* a = l->recs[i]->pkg.self.arch;
+        if (!arch || (a && strcmp(a, arch) == 0))
+            found[n++] = l->recs[i];
+    }
+
+    return n;
+}
+
+static int contains(stanza_rec** list, size_t cnt, const stanza_rec* rec) {
+    size_t i;
+
+    for (i = 0; i < cnt; i++)
+        if (list[i] == rec)
+            return 1;
+    return 0;
+}
+
+/* Collect the packages depending on p or something it provides. */
+static size_t dependents_of(const server* sv,
+                            const pkg_info* p,
+                            stanza_rec*** out_list) {
+    stanza_rec** list = NULL;
+    size_t cnt = 0, max = 0, i;
+    rec_list* l;
+    int j;
+
+    for (j = -1; j < p->provides_cnt; j++) {
+        const char* name = j < 0 ? p->self.name : p->provides[j].name;
+        if (!(l = rec_list_find(&sv->dependents, name)))
+            continue;
+        for (i = 0; i < l->cnt; i++) {
+            if (contains(list, cnt, l->recs[i]))
+                continue;
+            if (cnt >= max) {
+                max = max ? max * 2 : 16;
+                list = realloc(list, max * sizeof(stanza_rec*));
+            }
+            list[cnt++] = l->recs[i];
+        }
+    }
+
+    *out_list = list;
+    return cnt;
+}
+
+/* Requests */
+
+static void do_orphans(server* sv, client* c) {
+    stanza_rec* rec;
+
+    begin_reply(c);
+    begin_list(c);
+    for (rec = sv->snap.recs; rec; rec = rec->next)
+        if (rec->orphan)
+            list_pkg(sv, c, &rec->pkg, "");
+    end_list(c);
+    end_reply(c);
+}
+
+static void do_show_deps(server* sv, client* c, char** args, int nargs) {
+    stanza_rec *found[16], **deps;
+    size_t n, m, i, k;
+    int a, first = 1;
+
+    begin_reply(c);
+    if (c->json)
+        outs(c, "{");
+    for (a = 0; a < nargs; a++) {
+        n = lookup(sv, args[a], found, 16);
+        for (i = 0; i < n; i++) {
+            if (c->json) {
+                outs(c, first ? "" : ", ");
+                out_json_str(c, display_name(sv, &found[i]->pkg));
+                outs(c, ": ");
+            } else
+                list_pkg(sv, c, &found[i]->pkg, "");
+            first = 0;
+
+            m = dependents_of(sv, &found[i]->pkg, &deps);
+            begin_list(c);
+            for (k = 0; k < m; k++)
+                list_pkg(sv, c, &deps[k]->pkg, "      ");
+            end_list(c);
+            free(deps);
+        }
+    }
+    if (c->json)
+        outs(c, "}");
+    end_reply(c);
+}
+
+static void why_one(server* sv, client* c, const char* name, stanza_rec* rec) {
+    stanza_rec** deps = NULL;
+    const char* reason;
+    size_t m = 0, k;
+
+    if (!rec)
+        reason = "not-installed";
+    else if ((reason = candidate_reason(sv->ctx, &rec->pkg)))
+        ;
+    else if (needs_dependents_check(&rec->pkg) &&
+             (m = dependents_of(sv, &rec->pkg, &deps)))
+        reason = "needed";
+    else if (!is_reported(sv->ctx, &rec->pkg))
+        reason = "excluded";
+    else
+        reason = "orphan";
+
+    if (rec)
+        name = display_name(sv, &rec->pkg);
+
+    if (c->json) {
+        outs(c, c->items++ ? ", {\"package\": " : "{\"package\": ");
+        out_json_str(c, name);
+        outs(c, ", \"reason\": ");
+        out_json_str(c, reason);
+        outs(c, ", \"needed-by\": [");
+        for (k = 0; k < m; k++) {
+            outs(c, k ? ", " : "");
+            out_json_str(c, display_name(sv, &deps[k]->pkg));
+        }
+        outs(c, "]}");
+    } else {
+        outs(c, name);
+        outs(c, ": ");
+        outs(c, reason);
+        for (k = 0; k < m; k++) {
+            outs(c, k ? ", " : " by ");
+            outs(c, display_name(sv, &deps[k]->pkg));
+        }
+        outs(c, "\n");
+    }
+    free(deps);
+}
+
+static void do_why(server* sv, client* c, char** args, int nargs) {
+    stanza_rec* found[16];
+    size_t n, i;
+    int a;
+
+    begin_reply(c);
+    begin_list(c);
+    for (a = 0; a < nargs; a++) {
+        char* name = strdup(args[a]);
+        n = lookup(sv, args[a], found, 16);
+        if (!n)
+            why_one(sv, c, name, NULL);
+        for (i = 0; i < n; i++)
+            why_one(sv, c, name, found[i]);
+        free(name);
+    }
+    end_list(c);
+    end_reply(c);
+}
+
+/* Pretend the given packages were removed and report what would become
+ * an orphan. Only one level deep, like running deborphan again after
+ * removing them.
+ */
+static void do_what_if(server* sv, client* c, char** args, int nargs) {
+    stanza_rec *gone[MAX_ARGS], **orphans = NULL;
+    size_t ngone = 0, norphans = 0, i, k;
+    name_ref* r;
+    rec_list* l;
+    int a, j;
+
+    for (a = 0; a < nargs && ngone < MAX_ARGS; a++) {
+        stanza_rec* found[16];
+        size_t n = lookup(sv, args[a], found, 16);
+        for (i = 0; i < n && ngone < MAX_ARGS; i++)
+            if (!contains(gone, ngone, found[i]))
+                gone[ngone++] = found[i];
+    }
+
+    for (i = 0; i < ngone; i++)
+        for (j = 0; j < gone[i]->pkg.deps_cnt; j++)
+            name_ref_find(&sv->snap.rdeps, gone[i]->pkg.deps[j].name)->count--;
+
+    /* Only packages named after a dependency whose count dropped to zero
+     * can have changed. */
+    for (i = 0; i < ngone; i++) {
+        for (j = 0; j < gone[i]->pkg.deps_cnt; j++) {
+            const char* name = gone[i]->pkg.deps[j].name;
+            r = name_ref_find(&sv->snap.rdeps, name);
+            if (r->count != 0 || !(l = rec_list_find(&sv->providers, name)))
+                continue;
+            for (k = 0; k < l->cnt; k++) {
+                stanza_rec* rec = l->recs[k];
+                if (rec->orphan || contains(gone, ngone, rec) ||
+                    contains(orphans, norphans, rec) ||
+                    !rec_verdict(&sv->snap, rec))
+                    continue;
+                orphans = realloc(orphans, (norphans + 1) * sizeof(rec));
+                orphans[norphans++] = rec;
+            }
+        }
+    }
+
+    for (i = 0; i < ngone; i++)
+        for (j = 0; j < gone[i]->pkg.deps_cnt; j++)
+            name_ref_find(&sv->snap.rdeps, gone[i]->pkg.deps[j].name)->count++;
+
+    begin_reply(c);
+    begin_list(c);
+    for (i = 0; i < norphans; i++)
+        list_pkg(sv, c, &orphans[i]->pkg, "");
+    end_list(c);
+    end_reply(c);
+    free(orphans);
+}
+
+static void do_keep(server* sv, client* c, char** args, int nargs) {
+    stanza_rec* found[1];
+    dep* k;
+    int a, i;
+
+    if (nargs < 1) {
+        reply_error(c, "keep: list, add or del expected");
+        return;
+    }
+
+    if (strcmp(args[0], "list") == 0) {
+        begin_reply(c);
+        begin_list(c);
+        for (k = sv->ctx->keep.names; k && k->name; k++)
+            list_item(c, k->name, "");
+        end_list(c);
+        end_reply(c);
+        return;
+    }
+
+    if (nargs < 2) {
+        reply_error(c, "keep %s: not enough arguments", args[0]);
+        return;
+    }
+    /* Same as the command line, the arch suffix is not kept. */
+    for (a = 1; a < nargs; a++)
+        args[a][strcspn(args[a], ":")] = '\0';
+
+    if (strcmp(args[0], "add") == 0) {
+        for (a = 1; a < nargs; a++) {
+            char* name;
+            int n;
+
+            if (is_pattern(args[a]))
+                continue;
+            name = strdup(args[a]);
+            n = lookup(sv, name, found, 1);
+            free(name);
+            if (!n) {
+                reply_error(c, "%s: no such package", args[a]);
+                return;
+            }
+        }
+        if ((i = hasduplicate(&sv->ctx->keep, args + 1))) {
+            reply_error(c, "%s: duplicate entry", args[i]);
+            return;
+        }
+        if (addkeep(sv->kfile, args + 1) < 0) {
+            reply_error(c, "%s: %s", sv->kfile, strerror(errno));
+            return;
+        }
+    } else if (strcmp(args[0], "del") == 0) {
+        int removed = delkeep(sv->kfile, args + 1);
+
+        if (removed < 0) {
+            reply_error(c, "%s: %s", sv->kfile, strerror(errno));
+            return;
+        }
+        if (!removed) {
+            reply_error(c, "no packages removed");
+            return;
+        }
+    } else {
+        reply_error(c, "keep %s: list, add or del expected", args[0]);
+        return;
+    }
+
+    keep_free(&sv->ctx->keep);
+    readkeep_all(&sv->ctx->keep, sv->kfile, sv->ctx->options[NO_DEBFOSTER]);
+    snapshot_recheck(&sv->snap);
+
+    begin_reply(c);
+    begin_list(c);
+    end_list(c);
+    end_reply(c);
+}
+
+/* Parse a JSON string starting at *p, unescaping it in place. */
+static char* json_string(char** p) {
+    char *s, *d, *ret;
+
+    s = *p + strspn(*p, " \t\r\n");
+    if (*s != '"')
+        return NULL;
+    ret = d = ++s;
+    for (; *s != '"'; s++) {
+        if (*s == '\0')
+            return NULL;
+        if (*s == '\\') {
+            s++;
+            if (*s == 'n')
+                *d++ = '\n';
+            else if (*s == 't')
+                *d++ = '\t';
+            else if (*s == '"' || *s == '\\' || *s == '/')
+                *d++ = *s;
+            else
+                return NULL;
+        } else
+            *d++ = *s;
+    }
+    *p = s + 1;
+    *d = '\0';
+    return ret;
+}
+
+static int json_char(char** p, int c) {
+    *p += strspn(*p, " \t\r\n");
+    if (**p != c)
+        return 0;
+    (*p)++;
+    return 1;
+}
+
+/* Turn {"cmd": "...", "args": ["...", ...]} into words. Other keys with
+ * string values are ignored. */
+static int parse_json(char* line, char** words, int max) {
+    char *key, *val;
+    int n = 1;
+
+    words[0] = NULL;
+    if (!json_char(&line, '{'))
+        return -1;
+    if (json_char(&line, '}'))
+        return -1;
+
+    do {
+        if (!(key = json_string(&line)) || !json_char(&line, ':'))
+            return -1;
+        if (json_char(&line, '[')) {
+            if (strcmp(key, "args") != 0)
+                return -1;
+            if (!json_char(&line, ']')) {
+                do {
+                    if (!(val = json_string(&line)) || n >= max)
+                        return -1;
+                    words[n++] = val;
+                } while (json_char(&line, ','));
+                if (!json_char(&line, ']'))
+                    return -1;
+            }
+        } else {
+            if (!(val = json_string(&line)))
+                return -1;
+            if (strcmp(key, "cmd") == 0)
+                words[0] = val;
+        }
+    } while (json_char(&line, ','));
+
+    if (!json_char(&line, '}') || !words[0])
+        return -1;
+    return n;
+}
+
+static void handle_request(server* sv, client* c, char* line) {
+    char* words[MAX_ARGS + 1];
+    int n = 0;
+
+    line[strcspn(line, "\r")] = '\0';
+    line += strspn(line, " \t");
+
+    c->json = *line == '{';
+    if (c->json) {
+        if ((n = parse_json(line, words, MAX_ARGS)) < 0) {
+            reply_error(c, "invalid request");
+            return;
+        }
+    } else {
+        char* w;
+        while ((w = strsep(&line, " \t")) && n < MAX_ARGS)
+            if (*w)
+                words[n++] = w;
+        if (!n)
+            return;
+    }
+
+    if (sv->broken && strcmp(words[0], "reload") != 0)
+        reply_error(c, "%s: %s", sv->sfile, load_error(sv));
+    else if (strcmp(words[0], "orphans") == 0)
+        do_orphans(sv, c);
+    else if (strcmp(words[0], "show-deps") == 0)
+        do_show_deps(sv, c, words + 1, n - 1);
+    else if (strcmp(words[0], "why") == 0)
+        do_why(sv, c, words + 1, n - 1);
+    else if (strcmp(words[0], "what-if") == 0)
+        do_what_if(sv, c, words + 1, n - 1);
+    else if (strcmp(words[0], "keep") == 0) {
+        words[n] = NULL;
+        do_keep(sv, c, words + 1, n - 1);
+    } else if (strcmp(words[0], "reload") == 0) {
+        if (load(sv) < 0)
+            reply_error(c, "%s: %s", sv->sfile,
+                        errno == EBADMSG ? load_error(sv) : strerror(errno));
+        else {
+            begin_reply(c);
+            begin_list(c);
+            end_list(c);
+            end_reply(c);
+        }
+    } else
+        reply_error(c, "%s: unknown request", words[0]);
+}
+
+/* Connections */
+
+static void close_client(client* c) {
+    close(c->fd);
+    free(c->in);
+    free(c->out);
+    free(c);
+}
+
+/* Returns -1 if the client is gone. */
+static int flush_client(int ep, client* c) {
+    struct epoll_event ev;
+
+    while (c->outoff < c->outlen) {
+        ssize_t n = send(c->fd, c->out + c->outoff, c->outlen - c->outoff,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;
+        }
+        c->outoff += n;
+    }
+    if (c->outoff == c->outlen)
+        c->outoff = c->outlen = 0;
+
+    if (c->eof && !c->outlen)
+        return -1;
+
+    /* Only ask for EPOLLOUT while there is something left to send. */
+    ev.events = (c->eof ? 0 : EPOLLIN) | (c->outlen ? EPOLLOUT : 0);
+    if (ev.events != (unsigned)c->events) {
+        ev.data.ptr = c;
+        epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev);
+        c->events = ev.events;
+    }
+
+    return 0;
+}
+
+/* Answer the complete requests read so far, keeping the rest. */
+static void handle_requests(server* sv, client* c) {
+    char *line = c->in, *nl;
+
+    c->in[c->inlen] = '\0';
+    while ((nl = strchr(line, '\n'))) {
+        *nl = '\0';
+        handle_request(sv, c, line);
+        line = nl + 1;
+    }
+    c->inlen -= line - c->in;
+    memmove(c->in, line, c->inlen);
+}
+
+/* Returns -1 if the client is gone, or is to be dropped. */
+static int read_client(server* sv, int ep, client* c) {
+    char* in;
+    ssize_t n;
+
+    for (;;) {
+        if (c->inlen + 4096 > c->inmax) {
+            size_t max = c->inmax ? c->inmax * 2 : 8192;
+
+            if (!(in = realloc(c->in, max)))
+                return -1;
+            c->in = in;
+            c->inmax = max;
+        }
+        n = read(c->fd, c->in + c->inlen, c->inmax - c->inlen - 1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0) {
+            /* Answer what we got before closing. */
+            c->eof = 1;
+            break;
+        }
+        c->inlen += n;
+
+        /* What is left is part of a request, which can't grow beyond
+         * MAX_REQUEST however much the client sends. */
+        handle_requests(sv, c);
+        if (c->inlen > MAX_REQUEST)
+            return -1;
+    }
+
+    return flush_client(ep, c);
+}
+
+static int open_socket(const char* path) {
+    struct sockaddr_un addr;
+    struct stat st;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        error(EXIT_FAILURE, ENAMETOOLONG, "%s", path);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    /* Remove a stale socket left behind by an earlier instance. */
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) <
+        0)
+        error(EXIT_FAILURE, errno, "socket");
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+        error(EXIT_FAILURE, errno, "%s", path);
+    if (listen(fd, SOMAXCONN) < 0)
+        error(EXIT_FAILURE, errno, "%s", path);
+
+    return fd;
+}
+
+static long now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+void run_serve(context* ctx,
+               const char* sockpath,
+               const char* sfile,
+               const char* kfile,
+               const char* cfile) {
+    struct epoll_event ev, events[MAX_EVENTS];
+    server sv;
+    long reload_at = -1;
+    int lfd, nfd, ep, n, i;
+    char* name;
+
+    memset(&sv, 0, sizeof(sv));
+    sv.ctx = ctx;
+    sv.sfile = sfile;
+    sv.kfile = kfile;
+    sv.cfile = cfile;
+    snapshot_init(&sv.snap, ctx);
+    if (cfile && snapshot_load(&sv.snap, cfile) < 0 && errno != ENOENT)
+        fprintf(stderr, "%s: %s: %s, ignoring it\n", program_name, cfile,
+                strerror(errno));
+    /* A status file that can't be used yet will be read again. */
+    if (load(&sv) < 0 && !sv.broken)
+        exit(EXIT_FAILURE);
+
+    nfd = watch_status(sfile, &name);
+    lfd = open_socket(sockpath);
+
+    if ((ep = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        error(EXIT_FAILURE, errno, "epoll");
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listen_tag;
+    epoll_ctl(ep, EPOLL_CTL_ADD, lfd, &ev);
+    ev.data.ptr = &notify_tag;
+    epoll_ctl(ep, EPOLL_CTL_ADD, nfd, &ev);
+
+    for (;;) {
+        long timeout = -1;
+
+        if (reload_at >= 0 && (timeout = reload_at - now_ms()) < 0)
+            timeout = 0;
+
+        n = epoll_wait(ep, events, MAX_EVENTS, (int)timeout);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            error(EXIT_FAILURE, errno, "epoll_wait");
+        }
+
+        /* The status file has been left alone long enough. */
+        if (reload_at >= 0 && now_ms() >= reload_at) {
+            reload_at = -1;
+            load(&sv);
+        }
+
+        for (i = 0; i < n; i++) {
+            void* ptr = events[i].data.ptr;
+
+            if (ptr == &listen_tag) {
+                client* c;
+                int cfd;
+
+                while ((cfd = accept(lfd, NULL, NULL)) >= 0) {
+                    /* The flags of lfd are not passed on. */
+                    if (fcntl(cfd, F_SETFL, O_NONBLOCK) < 0 ||
+                        fcntl(cfd, F_SETFD, FD_CLOEXEC) < 0 ||
+                        !(c = calloc(1, sizeof(client)))) {
+                        close(cfd);
+                        continue;
+                    }
+                    c->fd = cfd;
+                    c->events = ev.events = EPOLLIN;
+                    ev.data.ptr = c;
+                    epoll_ctl(ep, EPOLL_CTL_ADD, cfd, &ev);
+                }
+            } else if (ptr == &notify_tag) {
+                if (watch_events(nfd, name))
+                    reload_at = now_ms() + WATCH_SETTLE_MS;
+            } else {
+                client* c = ptr;
+                int rv = 0;
+
+                if (!c->eof &&
+                    (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                    rv = read_client(&sv, ep, c);
+                else if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+                    rv = flush_client(ep, c);
+                if (rv < 0)
+                    close_client(c); /* also removes it from ep */
+            }
+        }
+    }
+}
@@ -24,6 +24,22 @@ unsigned int strhash(const char* line) {
     return r;
 }
 
+/* 64 bit FNV-1a hash of a block of memory. Unlike strhash() it looks at
+ * every byte, so it is good enough to key hash tables and to tell
+ * status file stanzas apart.
+ */
+unsigned long long memhash(const void* buf, size_t len) {
+    const unsigned char* p = buf;
+    unsigned long long r = 0xcbf29ce484222325ULL;
+
+    while (len--) {
+        r ^= *(p++);
+        r *= 0x100000001b3ULL;
+    }
+
+    return r;
+}
+
 /* This function removes all occurences of the character 'c' from the
    string 's'.
 */
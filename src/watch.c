@@ -0,0 +1,178 @@
+/* watch.c - Continuous orphan tracking for deborphan.
+
+   Distributed under the terms of the MIT License, see the
+   file COPYING provided in this package for details.
+*/
+
+/* With --watch, deborphan keeps the parsed status file in memory and
+ * waits for dpkg to replace it. Once the writes have settled, the
+ * snapshot is brought up to date (only changed stanzas are parsed again)
+ * and the changes to the set of orphans are printed as with --diff.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <cache.h>
+
+#include "config.h"
+#include "deborphan.h"
+
+static void reload(snapshot* s,
+                   const char* sfile,
+                   const char* cfile,
+                   orphan_set* orphans) {
+    orphan_set now;
+    char* content;
+    int print_suffix;
+
+    if (!(content = debopen_status(sfile))) {
+        /* Most probably caught dpkg in the middle of replacing it, we'll
+         * be told again when it's back. */
+        fprintf(stderr, "%s: %s: %s\n", program_name, sfile, strerror(errno));
+        return;
+    }
+    /* APT updates its marks along with dpkg's run. If they can't be read
+     * right now, the previous ones are kept. */
+    if (s->ctx->options[AUTO_ONLY] && read_extended_states(s->ctx, NULL) < 0)
+        fprintf(stderr, "%s: extended_states: %s\n", program_name,
+                strerror(errno));
+    if (snapshot_update(s, content) < 0) {
+        /* Most probably dpkg is still at work. This version is skipped,
+         * the changes show up with the next good one. */
+        fprintf(stderr, "%s: %s: %s, skipping it\n", program_name, sfile,
+                errno == EBADMSG ? bad_status_message(s->ctx->bad_status)
+                                 : strerror(errno));
+        free(content);
+        return;
+    }
+    free(content);
+
+    print_suffix = (s->ctx->options[SHOW_ARCH] == ALWAYS ||
+                    (s->ctx->options[SHOW_ARCH] == DEFAULT && s->multiarch));
+
+    collect_orphans(s, &now);
+    print_missing(s->ctx, orphans, &now, '-', print_suffix);
+    print_missing(s->ctx, &now, orphans, '+', print_suffix);
+    print_done(s->ctx);
+
+    free_orphans(orphans);
+    *orphans = now;
+
+    if (cfile && snapshot_save(s, cfile) < 0)
+        fprintf(stderr, "%s: %s: %s\n", program_name, cfile, strerror(errno));
+}
+
+/* The watch on dpkg's journal, see watch_status(). */
+static int journal_wd = -1;
+
+/* Read pending events, returns 1 if one of them was about name or a
+ * new journal entry.
+ */
+int watch_events(int fd, const char* name) {
+    char buf[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event* ev;
+    ssize_t len;
+    char* p;
+    int hit = 0;
+
+    len = read(fd, buf, sizeof(buf));
+    if (len < 0) {
+        if (errno == EINTR || errno == EAGAIN)
+            return 0;
+        error(EXIT_FAILURE, errno, "inotify");
+    }
+
+    for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+        ev = (const struct inotify_event*)p;
+        if (ev->mask & IN_Q_OVERFLOW)
+            hit = 1;
+        else if (ev->len && (ev->wd == journal_wd
+                                 ? is_journal_name(ev->name)
+                                 : strcmp(ev->name, name) == 0))
+            hit = 1;
+    }
+
+    return hit;
+}
+
+/* Block until the watched file changed and no more changes came in for
+ * WATCH_SETTLE_MS.
+ */
+static void wait_for_change(int fd, const char* name) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+
+    while (!watch_events(fd, name))
+        ;
+
+    for (;;) {
+        int rv = poll(&pfd, 1, WATCH_SETTLE_MS);
+        if (rv == 0)
+            return;
+        if (rv < 0 && errno != EINTR)
+            error(EXIT_FAILURE, errno, "poll");
+        if (rv > 0)
+            watch_events(fd, name);
+    }
+}
+
+/* Open an inotify descriptor watching the directory sfile is in, and
+ * dpkg's journal next to it. *name is set to the part of sfile events
+ * will carry.
+ */
+int watch_status(const char* sfile, char** name) {
+    char *dir = strdup(sfile), *slash;
+    int fd;
+
+    if ((slash = strrchr(dir, '/'))) {
+        *name = strdup(slash + 1);
+        if (slash == dir)
+            slash++;
+        *slash = '\0';
+    } else {
+        *name = dir;
+        dir = strdup(".");
+    }
+
+    if ((fd = inotify_init1(IN_CLOEXEC)) < 0)
+        error(EXIT_FAILURE, errno, "inotify");
+    /* dpkg writes status-new and renames it over status. */
+    if (inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+        error(EXIT_FAILURE, errno, "%s", dir);
+    free(dir);
+
+    /* Each step of a dpkg run adds a journal entry, folding them into
+     * the status file only comes at the end. A missing updates/ just
+     * means sfile isn't dpkg's. */
+    dir = status_updates_dir(sfile);
+    journal_wd = inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+    free(dir);
+    return fd;
+}
+
+void run_watch(context* ctx, const char* sfile, const char* cfile) {
+    orphan_set orphans = {NULL, NULL, NULL, 0, {NULL, 0, 0}};
+    snapshot s;
+    char* name;
+    int fd;
+
+    fd = watch_status(sfile, &name);
+
+    snapshot_init(&s, ctx);
+    if (cfile && snapshot_load(&s, cfile) < 0 && errno != ENOENT)
+        fprintf(stderr, "%s: %s: %s, ignoring it\n", program_name, cfile,
+                strerror(errno));
+
+    reload(&s, sfile, cfile, &orphans);
+
+    for (;;) {
+        wait_for_change(fd, name);
+        reload(&s, sfile, cfile, &orphans);
+    }
+}